@@ -0,0 +1,296 @@
+#include "math_engine.hpp"
+#include <cstdio>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+struct Options {
+    View view = {-10, 10, -10, 10, 1200, 700};
+    std::vector<std::string> eqs;
+    std::string csv, bin, png, trace;
+};
+
+class Raster {
+private:
+    int w, h;
+    std::vector<unsigned char> px;
+    
+    void plot(int x, int y, const unsigned char* c) {
+        if (x < 0 || y < 0 || x >= w || y >= h) return;
+        unsigned char* p = &px[(static_cast<size_t>(y) * w + x) * 3];
+        p[0] = c[0];
+        p[1] = c[1];
+        p[2] = c[2];
+    }
+    
+    static uint32_t crc(const unsigned char* p, size_t n, uint32_t c) {
+        static uint32_t table[256];
+        static bool ready = false;
+        if (!ready) {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t v = i;
+                for (int k = 0; k < 8; k++) v = v & 1 ? 0xedb88320u ^ (v >> 1) : v >> 1;
+                table[i] = v;
+            }
+            ready = true;
+        }
+        for (size_t i = 0; i < n; i++) c = table[(c ^ p[i]) & 0xff] ^ (c >> 8);
+        return c;
+    }
+    
+    static void put32(std::vector<unsigned char>& out, uint32_t v) {
+        out.push_back(v >> 24);
+        out.push_back(v >> 16);
+        out.push_back(v >> 8);
+        out.push_back(v);
+    }
+    
+    static void chunk(std::ofstream& f, const char* type, const std::vector<unsigned char>& data) {
+        std::vector<unsigned char> out;
+        put32(out, static_cast<uint32_t>(data.size()));
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data.begin(), data.end());
+        put32(out, crc(&out[4], out.size() - 4, 0xffffffffu) ^ 0xffffffffu);
+        f.write(reinterpret_cast<const char*>(out.data()), out.size());
+    }
+    
+public:
+    Raster(int width, int height) : w(width), h(height), px(static_cast<size_t>(width) * height * 3, 0) {}
+    
+    void line(float x0, float y0, float x1, float y1, const unsigned char* c) {
+        float lo = -4.0f * h, hi = 5.0f * h;
+        y0 = std::max(lo, std::min(hi, y0));
+        y1 = std::max(lo, std::min(hi, y1));
+        if ((x0 < 0 && x1 < 0) || (x0 >= w && x1 >= w) || (y0 < 0 && y1 < 0) || (y0 >= h && y1 >= h)) return;
+        
+        int steps = static_cast<int>(std::max(fabs(x1 - x0), fabs(y1 - y0))) + 1;
+        for (int i = 0; i <= steps; i++) {
+            float t = static_cast<float>(i) / steps;
+            plot(static_cast<int>(floor(x0 + (x1 - x0) * t)), static_cast<int>(floor(y0 + (y1 - y0) * t)), c);
+        }
+    }
+    
+    // Stored (uncompressed) deflate blocks keep the encoder dependency-free.
+    bool save(const std::string& path) const {
+        std::ofstream f(path, std::ios::binary);
+        if (!f) return false;
+        
+        std::vector<unsigned char> raw;
+        raw.reserve(static_cast<size_t>(w * 3 + 1) * h);
+        for (int y = 0; y < h; y++) {
+            raw.push_back(0);
+            raw.insert(raw.end(), px.begin() + static_cast<size_t>(y) * w * 3, px.begin() + static_cast<size_t>(y + 1) * w * 3);
+        }
+        
+        std::vector<unsigned char> z = {0x78, 0x01};
+        uint32_t a = 1, b = 0;
+        for (size_t pos = 0; pos < raw.size() || pos == 0; pos += 65535) {
+            size_t len = std::min<size_t>(65535, raw.size() - pos);
+            z.push_back(pos + len >= raw.size() ? 1 : 0);
+            z.push_back(len & 0xff);
+            z.push_back(len >> 8);
+            z.push_back(~len & 0xff);
+            z.push_back((~len >> 8) & 0xff);
+            z.insert(z.end(), raw.begin() + pos, raw.begin() + pos + len);
+            for (size_t i = pos; i < pos + len; i++) {
+                a = (a + raw[i]) % 65521;
+                b = (b + a) % 65521;
+            }
+        }
+        put32(z, b << 16 | a);
+        
+        std::vector<unsigned char> hdr;
+        put32(hdr, w);
+        put32(hdr, h);
+        hdr.insert(hdr.end(), {8, 2, 0, 0, 0});
+        
+        static const unsigned char sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        f.write(reinterpret_cast<const char*>(sig), 8);
+        chunk(f, "IHDR", hdr);
+        chunk(f, "IDAT", z);
+        chunk(f, "IEND", {});
+        return static_cast<bool>(f);
+    }
+};
+
+static void usage() {
+    std::cerr << "usage: math_batch [-e EQ]... [-view XMIN XMAX YMIN YMAX] [-size W H]\n"
+                 "                  [-csv FILE] [-bin FILE] [-png FILE] [-trace FILE] [EQUATION_FILE|-]\n";
+}
+
+static bool parseArgs(int argc, char** argv, Options& opt) {
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        auto need = [&](int n) { return i + n < argc; };
+        if (a == "-e" && need(1)) {
+            opt.eqs.push_back(argv[++i]);
+        } else if (a == "-view" && need(4)) {
+            opt.view.xMin = atof(argv[++i]);
+            opt.view.xMax = atof(argv[++i]);
+            opt.view.yMin = atof(argv[++i]);
+            opt.view.yMax = atof(argv[++i]);
+        } else if (a == "-size" && need(2)) {
+            opt.view.w = atoi(argv[++i]);
+            opt.view.h = atoi(argv[++i]);
+        } else if (a == "-csv" && need(1)) {
+            opt.csv = argv[++i];
+        } else if (a == "-bin" && need(1)) {
+            opt.bin = argv[++i];
+        } else if (a == "-png" && need(1)) {
+            opt.png = argv[++i];
+        } else if (a == "-trace" && need(1)) {
+            opt.trace = argv[++i];
+        } else if (a == "-" || a[0] != '-') {
+            std::ifstream file;
+            if (a != "-") {
+                file.open(a);
+                if (!file) {
+                    std::cerr << "cannot open " << a << std::endl;
+                    return false;
+                }
+            }
+            std::istream& in = a == "-" ? std::cin : file;
+            std::string line;
+            while (std::getline(in, line)) {
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                if (line.empty() || line[0] == '#') continue;
+                opt.eqs.push_back(line);
+            }
+        } else {
+            return false;
+        }
+    }
+    
+    const View& v = opt.view;
+    return v.w > 0 && v.h > 0 && v.xMax > v.xMin && v.yMax > v.yMin;
+}
+
+static bool writeCsv(const std::string& path, const Snapshot& s) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) return false;
+    fprintf(f, "eq,line,x,y\n");
+    for (size_t e = 0; e < s.lines.size(); e++) {
+        for (size_t l = 0; l < s.lines[e].size(); l++) {
+            for (const CurvePoint& p : s.lines[e][l]) {
+                fprintf(f, "%zu,%zu,%.9g,%.9g\n", e, l, p.x, p.y);
+            }
+        }
+    }
+    return fclose(f) == 0;
+}
+
+// "MVPL", u32 version, u32 equation count, then per equation a u32 line count
+// and per line a u32 point count followed by float32 x/y pairs. Native byte order.
+static bool writeBinary(const std::string& path, const Snapshot& s) {
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    bool ok = fwrite("MVPL", 1, 4, f) == 4;
+    auto put = [f, &ok](uint32_t v) { ok = ok && fwrite(&v, 4, 1, f) == 1; };
+    put(1);
+    put(static_cast<uint32_t>(s.lines.size()));
+    std::vector<float> buf;
+    for (const auto& lines : s.lines) {
+        put(static_cast<uint32_t>(lines.size()));
+        for (const auto& line : lines) {
+            put(static_cast<uint32_t>(line.size()));
+            buf.clear();
+            for (const CurvePoint& p : line) {
+                buf.push_back(static_cast<float>(p.x));
+                buf.push_back(static_cast<float>(p.y));
+            }
+            ok = ok && fwrite(buf.data(), sizeof(float), buf.size(), f) == buf.size();
+        }
+    }
+    return fclose(f) == 0 && ok;
+}
+
+static bool writePng(const std::string& path, const Snapshot& s) {
+    static const unsigned char cols[8][3] = {
+        {255, 0, 0}, {0, 0, 255}, {0, 255, 0}, {255, 255, 0},
+        {255, 0, 255}, {0, 255, 255}, {255, 165, 0}, {128, 0, 128}};
+    static const unsigned char axis[3] = {200, 200, 200};
+    
+    const View& v = s.view;
+    Raster r(v.w, v.h);
+    auto sx = [&v](double x) { return static_cast<float>((x - v.xMin) / (v.xMax - v.xMin) * v.w); };
+    auto sy = [&v](double y) { return static_cast<float>(v.h - (y - v.yMin) / (v.yMax - v.yMin) * v.h); };
+    
+    r.line(0, sy(0), static_cast<float>(v.w), sy(0), axis);
+    r.line(sx(0), 0, sx(0), static_cast<float>(v.h), axis);
+    for (size_t e = 0; e < s.lines.size(); e++) {
+        for (const auto& line : s.lines[e]) {
+            for (size_t i = 0; i + 1 < line.size(); i++) {
+                r.line(sx(line[i].x), sy(line[i].y), sx(line[i + 1].x), sy(line[i + 1].y), cols[e % 8]);
+            }
+        }
+    }
+    return r.save(path);
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parseArgs(argc, argv, opt) || opt.eqs.empty()) {
+        usage();
+        return 2;
+    }
+    
+    using Clock = std::chrono::steady_clock;
+    auto ms = [](Clock::time_point a, Clock::time_point b) {
+        return std::chrono::duration<double, std::milli>(b - a).count();
+    };
+    
+    Clock::time_point t0 = Clock::now();
+    Parser parser;
+    Symbols symbols;
+    std::vector<std::string> texts;
+    for (const std::string& text : opt.eqs) {
+        std::string name;
+        if (!parser.define(text, symbols, name)) texts.push_back(text);
+    }
+    if (texts.empty()) {
+        usage();
+        return 2;
+    }
+    std::vector<std::shared_ptr<Equation>> eqs;
+    eqs.reserve(texts.size());
+    for (const std::string& text : texts) {
+        eqs.push_back(std::make_shared<Equation>(text, parser.compile(text, symbols)));
+    }
+    
+    Clock::time_point t1 = Clock::now();
+    Profiler::get().enable(!opt.trace.empty());
+    Sampler sampler(false);
+    std::shared_ptr<const Snapshot> snap = sampler.sampleNow(opt.view, eqs);
+    
+    Clock::time_point t2 = Clock::now();
+    bool ok = true;
+    if (!opt.csv.empty() && !writeCsv(opt.csv, *snap)) {
+        std::cerr << "cannot write " << opt.csv << std::endl;
+        ok = false;
+    }
+    if (!opt.bin.empty() && !writeBinary(opt.bin, *snap)) {
+        std::cerr << "cannot write " << opt.bin << std::endl;
+        ok = false;
+    }
+    if (!opt.png.empty() && !writePng(opt.png, *snap)) {
+        std::cerr << "cannot write " << opt.png << std::endl;
+        ok = false;
+    }
+    if (!opt.trace.empty() && !Profiler::get().writeTrace(opt.trace)) {
+        std::cerr << "cannot write " << opt.trace << std::endl;
+        ok = false;
+    }
+    Clock::time_point t3 = Clock::now();
+    
+    size_t evals = 0, points = 0;
+    for (const auto& eq : eqs) evals += eq->evals;
+    for (const auto& lines : snap->lines) {
+        for (const auto& line : lines) points += line.size();
+    }
+    double sampleMs = ms(t1, t2);
+    fprintf(stderr, "equations %zu  evals %zu  points %zu\n", eqs.size(), evals, points);
+    fprintf(stderr, "parse %.1f ms  sample %.1f ms  write %.1f ms\n", ms(t0, t1), sampleMs, ms(t2, t3));
+    fprintf(stderr, "throughput %.0f eq/s  %.1f Mevals/s\n",
+            eqs.size() / (sampleMs / 1000), evals / (sampleMs * 1000));
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,296 @@
+#include "math_plotter.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<size_t> allocs(0);
+
+void* operator new(size_t n) {
+    allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+struct Corpus {
+    const char* name;
+    std::vector<std::string> eqs;
+};
+
+struct Range {
+    const char* name;
+    double xMin, xMax, yMin, yMax;
+};
+
+static const std::vector<Corpus>& corpora() {
+    static const std::vector<Corpus> c = {
+        {"poly", {"x^3 - 2*x^2 + x - 1", "0.5*x^5 - 3*x^3 + x", "(x - 1)*(x + 2)*(x - 3)/10"}},
+        {"trig", {"sin(x)", "cos(3*x)*sin(x)", "tan(x)", "sin(x)^2 + cos(x)/2"}},
+        {"nested", {"sin(cos(x^2))", "sqrt(abs(sin(x)))*exp(-x^2/10)", "log(1 + x^2)*sin(1/x)", "exp(sin(x))/(1 + abs(x))"}},
+        {"implicit", {"x^2 + y^2 - 25", "x^2/9 - y^2/4 - 1", "y - x^2 + 3", "sin(x)*cos(y) - 0.3"}},
+        {"shared", {"2*pi*x + sin(x)^2 + cos(x)^2 + sin(x)*3", "sin(x)^2 + sin(x)", "sin(x)"}},
+    };
+    return c;
+}
+
+static const std::vector<Range>& ranges() {
+    static const std::vector<Range> r = {
+        {"unit", -1, 1, -1, 1},
+        {"default", -10, 10, -10, 10},
+        {"wide", -1000, 1000, -1000, 1000},
+    };
+    return r;
+}
+
+// One JSON object per line. For draw_* benches an iteration is one frame.
+class Report {
+private:
+    using Clock = std::chrono::steady_clock;
+    
+    std::string bench, name;
+    Clock::time_point start;
+    size_t allocStart;
+    
+public:
+    Report(const std::string& b, const std::string& n)
+        : bench(b), name(n), start(Clock::now()), allocStart(allocs.load()) {}
+    
+    double elapsedMs() const {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+    
+    void finish(size_t iters, size_t evals) {
+        double ns = elapsedMs() * 1e6;
+        size_t a = allocs.load() - allocStart;
+        printf("{\"bench\":\"%s\",\"case\":\"%s\",\"iters\":%zu,\"ns_per_iter\":%.1f,"
+               "\"evals_per_iter\":%.1f,\"ns_per_eval\":%.3f,\"samples_per_sec\":%.0f,\"allocs_per_iter\":%.2f}\n",
+               bench.c_str(), name.c_str(), iters, ns / iters,
+               static_cast<double>(evals) / iters, evals ? ns / evals : 0.0,
+               evals ? evals / (ns / 1e9) : 0.0, static_cast<double>(a) / iters);
+        fflush(stdout);
+    }
+};
+
+static volatile double sink;
+
+static void benchParser() {
+    Parser parser;
+    const size_t points = 2000;
+    for (const Corpus& c : corpora()) {
+        Report r("parser_eval", c.name);
+        double acc = 0;
+        for (size_t i = 0; i < points; i++) {
+            double x = -10 + 20.0 * i / points;
+            for (const std::string& eq : c.eqs) acc += parser.eval(eq, x, 0.5 * x);
+        }
+        sink = acc;
+        r.finish(points * c.eqs.size(), points * c.eqs.size());
+    }
+    
+    for (const Corpus& c : corpora()) {
+        std::vector<Program> progs;
+        for (const std::string& eq : c.eqs) progs.push_back(parser.compile(eq));
+        
+        const size_t scalar = 200000;
+        Report r("program_eval", c.name);
+        double acc = 0;
+        for (size_t i = 0; i < scalar; i++) {
+            double x = -10 + 20.0 * i / scalar;
+            for (const Program& p : progs) acc += p.eval(x, 0.5 * x);
+        }
+        sink = acc;
+        r.finish(scalar * progs.size(), scalar * progs.size());
+        
+        const size_t n = 4096, rounds = 200;
+        std::vector<double> xs(n), ys(n), out(n);
+        for (size_t i = 0; i < n; i++) {
+            xs[i] = -10 + 20.0 * i / n;
+            ys[i] = 0.5 * xs[i];
+        }
+        Report b("batch_eval", c.name);
+        for (size_t k = 0; k < rounds; k++) {
+            for (const Program& p : progs) p.evalBatch(xs.data(), ys.data(), out.data(), n);
+        }
+        sink = out[n / 2];
+        b.finish(rounds * progs.size(), rounds * progs.size() * n);
+        
+        std::vector<const Program*> ptrs;
+        for (const Program& p : progs) ptrs.push_back(&p);
+        Program fused = Optimizer().fuse(ptrs);
+        if (fused.outputCount() != static_cast<int>(progs.size())) {
+            printf("{\"bench\":\"fused_eval\",\"case\":\"%s\",\"skipped\":\"fuse failed\"}\n", c.name);
+            continue;
+        }
+        std::vector<double> streams(n * progs.size());
+        std::vector<double*> outs;
+        for (size_t k = 0; k < progs.size(); k++) outs.push_back(&streams[k * n]);
+        
+        // The fused pass has to reproduce every program's own results before it is timed.
+        fused.evalBatch(xs.data(), ys.data(), outs.data(), static_cast<int>(outs.size()), n);
+        for (size_t k = 0; k < progs.size(); k++) {
+            progs[k].evalBatch(xs.data(), ys.data(), out.data(), n);
+            for (size_t i = 0; i < n; i++) {
+                double a = out[i], b = outs[k][i];
+                if (std::isnan(a) && std::isnan(b)) continue;
+                if (!(fabs(a - b) <= 1e-9 * (1 + fabs(a)))) {
+                    fprintf(stderr, "fused_eval %s: \"%s\" differs at x = %g (%g vs %g)\n",
+                            c.name, c.eqs[k].c_str(), xs[i], b, a);
+                    exit(1);
+                }
+            }
+        }
+        
+        Report f("fused_eval", c.name);
+        for (size_t k = 0; k < rounds; k++) {
+            fused.evalBatch(xs.data(), ys.data(), outs.data(), static_cast<int>(outs.size()), n);
+        }
+        sink = streams[n / 2];
+        f.finish(rounds, rounds * progs.size() * n);
+    }
+}
+
+static void benchSampler() {
+    Parser parser;
+    Sampler sampler(false);
+    const int w = 1200, h = 700;
+    
+    for (const Corpus& c : corpora()) {
+        for (const Range& v : ranges()) {
+            std::string name = std::string(c.name) + "/" + v.name;
+            const size_t iters = 10;
+            
+            Report cold("sample_cold", name);
+            size_t evals = 0;
+            for (size_t i = 0; i < iters; i++) {
+                std::vector<std::shared_ptr<Equation>> eqs;
+                for (const std::string& eq : c.eqs) eqs.push_back(std::make_shared<Equation>(eq, parser.compile(eq)));
+                sampler.sampleNow({v.xMin, v.xMax, v.yMin, v.yMax, w, h}, eqs);
+                for (const auto& eq : eqs) evals += eq->evals;
+            }
+            cold.finish(iters, evals);
+            
+            std::vector<std::shared_ptr<Equation>> eqs;
+            for (const std::string& eq : c.eqs) eqs.push_back(std::make_shared<Equation>(eq, parser.compile(eq)));
+            View view = {v.xMin, v.xMax, v.yMin, v.yMax, w, h};
+            sampler.sampleNow(view, eqs);
+            size_t before = 0;
+            for (const auto& eq : eqs) before += eq->evals;
+            
+            const size_t frames = 60;
+            double dx = 7 * (v.xMax - v.xMin) / w;
+            Report pan("sample_pan", name);
+            for (size_t i = 0; i < frames; i++) {
+                view.xMin += dx;
+                view.xMax += dx;
+                sampler.sampleNow(view, eqs);
+            }
+            size_t after = 0;
+            for (const auto& eq : eqs) after += eq->evals;
+            pan.finish(frames, after - before);
+        }
+    }
+}
+
+// The 320 MB series goes to $TMPDIR and is unlinked as soon as it is mapped.
+static void benchData() {
+    const size_t n = 20000000;
+    const char* tmp = getenv("TMPDIR");
+    std::string path = std::string(tmp && *tmp ? tmp : "/tmp") + "/math_bench_series.mvds";
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+        printf("{\"bench\":\"data\",\"case\":\"skipped\",\"reason\":\"cannot write %s\"}\n", path.c_str());
+        return;
+    }
+    uint32_t version = 1;
+    uint64_t count = n;
+    bool ok = fwrite("MVDS", 1, 4, f) == 4 && fwrite(&version, 4, 1, f) == 1 && fwrite(&count, 8, 1, f) == 1;
+    std::vector<CurvePoint> chunk;
+    for (size_t i = 0; i < n && ok; i++) {
+        double x = -1000 + 2000.0 * i / n;
+        chunk.push_back({x, 5 * sin(x) + sin(97 * x) + 0.001 * static_cast<double>(i % 1000)});
+        if (chunk.size() == 65536 || i + 1 == n) {
+            ok = fwrite(chunk.data(), sizeof(CurvePoint), chunk.size(), f) == chunk.size();
+            chunk.clear();
+        }
+    }
+    ok = fclose(f) == 0 && ok;
+    if (!ok) {
+        remove(path.c_str());
+        printf("{\"bench\":\"data\",\"case\":\"skipped\",\"reason\":\"short write to %s\"}\n", path.c_str());
+        return;
+    }
+    
+    DataSeries series;
+    Report open("data_open", "20M");
+    ok = series.open(path);
+    open.finish(1, ok ? n : 0);
+    remove(path.c_str());
+    if (!ok || series.size() != n) {
+        fprintf(stderr, "data_open: %s\n", series.error().c_str());
+        exit(1);
+    }
+    
+    std::vector<CurvePoint> out;
+    for (const Range& v : ranges()) {
+        const size_t frames = 200;
+        double dx = 7 * (v.xMax - v.xMin) / 1200;
+        Report pan("data_pan", v.name);
+        for (size_t i = 0; i < frames; i++) series.decimate(v.xMin + i * dx, v.xMax + i * dx, 1200, out);
+        pan.finish(frames, 0);
+    }
+}
+
+static void benchRender() {
+    sf::RenderTexture target;
+    if (!target.create(1200, 800)) {
+        printf("{\"bench\":\"draw\",\"case\":\"skipped\",\"reason\":\"no render context\"}\n");
+        return;
+    }
+    
+    for (const Range& v : ranges()) {
+        Plotter plot(target);
+        plot.setView(v.xMin, v.xMax, v.yMin, v.yMax);
+        std::streambuf* out = std::cout.rdbuf(nullptr);
+        for (const Corpus& c : corpora()) {
+            for (const std::string& eq : c.eqs) plot.add(eq);
+        }
+        std::cout.rdbuf(out);
+        while (!plot.settled()) {
+            plot.draw();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        
+        const size_t frames = 200;
+        Report grid("draw_grid", v.name);
+        for (size_t i = 0; i < frames; i++) plot.drawGrid();
+        grid.finish(frames, 0);
+        
+        Report labels("draw_labels", v.name);
+        for (size_t i = 0; i < frames; i++) plot.drawLabels();
+        labels.finish(frames, 0);
+        
+        Report eqs("draw_eqs", v.name);
+        for (size_t i = 0; i < frames; i++) plot.drawEqs();
+        eqs.finish(frames, 0);
+        
+        Report frame("draw_frame", v.name);
+        for (size_t i = 0; i < frames; i++) {
+            target.clear(sf::Color::Black);
+            plot.draw();
+            target.display();
+        }
+        frame.finish(frames, 0);
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string only = argc > 1 ? argv[1] : "";
+    if (only.empty() || only == "eval") benchParser();
+    if (only.empty() || only == "sample") benchSampler();
+    if (only.empty() || only == "data") benchData();
+    if (only.empty() || only == "draw") benchRender();
+    return 0;
+}
@@ -0,0 +1,4070 @@
+#ifndef MATH_ENGINE_HPP
+#define MATH_ENGINE_HPP
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <complex>
+#include <cctype>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <deque>
+#include <list>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <fstream>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#define MV_HAS_JIT 1
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define MV_HAS_MMAP 1
+#endif
+
+// SessionCache stores ops as their byte values and derives its format version
+// from Imag; new ops go after it and move the last-op marker there.
+enum class Op : unsigned char {
+    Const, VarX, VarY, Load, Store,
+    Add, Sub, Mul, Div, Pow, Neg,
+    Sin, Cos, Tan, Log, Sqrt, Exp, Abs, Sqr, Poly, Imag
+};
+
+struct Instr {
+    Op op;
+    double val;
+};
+
+inline double safeDiv(double a, double b) { return b != 0 ? a / b : 0; }
+inline double safeLog(double a) { return a > 0 ? log(a) : 0; }
+inline double safeSqrt(double a) { return a >= 0 ? sqrt(a) : 0; }
+
+inline double applyFunc(Op op, double a) {
+    switch (op) {
+        case Op::Neg:  return -a;
+        case Op::Sin:  return sin(a);
+        case Op::Cos:  return cos(a);
+        case Op::Tan:  return tan(a);
+        case Op::Log:  return safeLog(a);
+        case Op::Sqrt: return safeSqrt(a);
+        case Op::Exp:  return exp(a);
+        case Op::Abs:  return fabs(a);
+        case Op::Sqr:  return a * a;
+        default:       return 0;
+    }
+}
+
+inline double applyBinary(Op op, double a, double b) {
+    switch (op) {
+        case Op::Add: return a + b;
+        case Op::Sub: return a - b;
+        case Op::Mul: return a * b;
+        case Op::Div: return safeDiv(a, b);
+        case Op::Pow: return pow(a, b);
+        default:      return 0;
+    }
+}
+
+// A polynomial block: the degree in x, the degree in y, then dx + 1 rows of
+// dy + 1 coefficients, row i holding those of x^i y^0 .. x^i y^dy.
+inline double polyAt(const double* c, double x, double y) {
+    int dx = static_cast<int>(c[0]), dy = static_cast<int>(c[1]);
+    c += 2;
+    double acc = 0;
+    for (int i = dx; i >= 0; i--) {
+        const double* r = c + i * (dy + 1);
+        double q = r[dy];
+        for (int j = dy - 1; j >= 0; j--) q = q * y + r[j];
+        acc = i == dx ? q : acc * x + q;
+    }
+    return acc;
+}
+
+namespace simd {
+
+#if defined(__AVX__)
+typedef __m256d vec;
+const size_t width = 4;
+inline vec load(const double* p) { return _mm256_loadu_pd(p); }
+inline void store(double* p, vec v) { _mm256_storeu_pd(p, v); }
+inline vec splat(double v) { return _mm256_set1_pd(v); }
+inline vec vadd(vec a, vec b) { return _mm256_add_pd(a, b); }
+inline vec vsub(vec a, vec b) { return _mm256_sub_pd(a, b); }
+inline vec vmul(vec a, vec b) { return _mm256_mul_pd(a, b); }
+inline vec vdiv(vec a, vec b) {
+    vec nz = _mm256_cmp_pd(b, _mm256_setzero_pd(), _CMP_NEQ_UQ);
+    return _mm256_and_pd(nz, _mm256_div_pd(a, b));
+}
+inline vec vsqrt(vec a) {
+    vec ok = _mm256_cmp_pd(a, _mm256_setzero_pd(), _CMP_GE_OQ);
+    return _mm256_and_pd(ok, _mm256_sqrt_pd(a));
+}
+inline vec vquot(vec a, vec b) { return _mm256_div_pd(a, b); }
+inline vec vabs(vec a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+inline vec vneg(vec a) { return _mm256_xor_pd(a, _mm256_set1_pd(-0.0)); }
+#elif defined(__SSE2__)
+typedef __m128d vec;
+const size_t width = 2;
+inline vec load(const double* p) { return _mm_loadu_pd(p); }
+inline void store(double* p, vec v) { _mm_storeu_pd(p, v); }
+inline vec splat(double v) { return _mm_set1_pd(v); }
+inline vec vadd(vec a, vec b) { return _mm_add_pd(a, b); }
+inline vec vsub(vec a, vec b) { return _mm_sub_pd(a, b); }
+inline vec vmul(vec a, vec b) { return _mm_mul_pd(a, b); }
+inline vec vdiv(vec a, vec b) {
+    vec nz = _mm_cmpneq_pd(b, _mm_setzero_pd());
+    return _mm_and_pd(nz, _mm_div_pd(a, b));
+}
+inline vec vsqrt(vec a) {
+    vec ok = _mm_cmpge_pd(a, _mm_setzero_pd());
+    return _mm_and_pd(ok, _mm_sqrt_pd(a));
+}
+inline vec vquot(vec a, vec b) { return _mm_div_pd(a, b); }
+inline vec vabs(vec a) { return _mm_andnot_pd(_mm_set1_pd(-0.0), a); }
+inline vec vneg(vec a) { return _mm_xor_pd(a, _mm_set1_pd(-0.0)); }
+#else
+typedef double vec;
+const size_t width = 1;
+inline vec load(const double* p) { return *p; }
+inline void store(double* p, vec v) { *p = v; }
+inline vec splat(double v) { return v; }
+inline vec vadd(vec a, vec b) { return a + b; }
+inline vec vsub(vec a, vec b) { return a - b; }
+inline vec vmul(vec a, vec b) { return a * b; }
+inline vec vdiv(vec a, vec b) { return safeDiv(a, b); }
+inline vec vsqrt(vec a) { return safeSqrt(a); }
+inline vec vquot(vec a, vec b) { return a / b; }
+inline vec vabs(vec a) { return fabs(a); }
+inline vec vneg(vec a) { return -a; }
+#endif
+
+inline size_t padded(size_t n) { return (n + width - 1) / width * width; }
+
+inline void fill(double* a, double v, size_t n) {
+    vec s = splat(v);
+    for (size_t i = 0; i < n; i += width) store(a + i, s);
+}
+
+inline bool uniformSmallInt(const double* b, size_t n, int& k) {
+    if (b[0] != floor(b[0]) || b[0] < 0 || b[0] > 16) return false;
+    for (size_t i = 1; i < n; i++) {
+        if (b[i] != b[0]) return false;
+    }
+    k = static_cast<int>(b[0]);
+    return true;
+}
+
+inline void powInt(double* a, int k, size_t n) {
+    for (size_t i = 0; i < n; i += width) {
+        vec base = load(a + i);
+        vec result = splat(1.0);
+        for (int e = k; e > 0; e >>= 1) {
+            if (e & 1) result = vmul(result, base);
+            base = vmul(base, base);
+        }
+        store(a + i, result);
+    }
+}
+
+inline void binary(Op op, double* a, const double* b, size_t n) {
+    int k;
+    if (op == Op::Pow && uniformSmallInt(b, n, k)) {
+        powInt(a, k, n);
+        return;
+    }
+    switch (op) {
+        case Op::Add: for (size_t i = 0; i < n; i += width) store(a + i, vadd(load(a + i), load(b + i))); break;
+        case Op::Sub: for (size_t i = 0; i < n; i += width) store(a + i, vsub(load(a + i), load(b + i))); break;
+        case Op::Mul: for (size_t i = 0; i < n; i += width) store(a + i, vmul(load(a + i), load(b + i))); break;
+        case Op::Div: for (size_t i = 0; i < n; i += width) store(a + i, vdiv(load(a + i), load(b + i))); break;
+        default:      for (size_t i = 0; i < n; i++) a[i] = applyBinary(op, a[i], b[i]); break;
+    }
+}
+
+// c[0] + c[1]*x + ... + c[D]*x^D, unrolled at compile time.
+template <int D>
+struct Horner {
+    static vec eval(const double* c, vec x) { return vadd(vmul(Horner<D - 1>::eval(c + 1, x), x), splat(c[0])); }
+};
+
+template <>
+struct Horner<0> {
+    static vec eval(const double* c, vec) { return splat(c[0]); }
+};
+
+inline vec horner(const double* c, int d, vec x) {
+    vec acc = splat(c[d]);
+    for (int i = d - 1; i >= 0; i--) acc = vadd(vmul(acc, x), splat(c[i]));
+    return acc;
+}
+
+template <int D>
+inline void polyX(const double* c, const double* x, double* out, size_t n) {
+    for (size_t i = 0; i < n; i += width) store(out + i, Horner<D>::eval(c, load(x + i)));
+}
+
+// Horner in x over rows that are themselves Horner in y of degree D.
+template <int D>
+inline void polyXY(const double* c, int dx, const double* x, const double* y, double* out, size_t n) {
+    for (size_t i = 0; i < n; i += width) {
+        vec vx = load(x + i), vy = load(y + i);
+        vec acc = Horner<D>::eval(c + dx * (D + 1), vy);
+        for (int r = dx - 1; r >= 0; r--) acc = vadd(vmul(acc, vx), Horner<D>::eval(c + r * (D + 1), vy));
+        store(out + i, acc);
+    }
+}
+
+// Evaluates a polynomial block (see polyAt) with kernels specialised for low degrees.
+inline void poly(const double* c, const double* x, const double* y, double* out, size_t n) {
+    int dx = static_cast<int>(c[0]), dy = static_cast<int>(c[1]);
+    c += 2;
+    if (dy == 0) {
+        switch (dx) {
+            case 0: fill(out, c[0], n); return;
+            case 1: polyX<1>(c, x, out, n); return;
+            case 2: polyX<2>(c, x, out, n); return;
+            case 3: polyX<3>(c, x, out, n); return;
+            case 4: polyX<4>(c, x, out, n); return;
+            case 5: polyX<5>(c, x, out, n); return;
+            case 6: polyX<6>(c, x, out, n); return;
+            case 7: polyX<7>(c, x, out, n); return;
+            case 8: polyX<8>(c, x, out, n); return;
+            default:
+                for (size_t i = 0; i < n; i += width) store(out + i, horner(c, dx, load(x + i)));
+                return;
+        }
+    }
+    switch (dy) {
+        case 1: polyXY<1>(c, dx, x, y, out, n); return;
+        case 2: polyXY<2>(c, dx, x, y, out, n); return;
+        case 3: polyXY<3>(c, dx, x, y, out, n); return;
+        case 4: polyXY<4>(c, dx, x, y, out, n); return;
+        default:
+            for (size_t i = 0; i < n; i += width) {
+                vec vx = load(x + i), vy = load(y + i);
+                vec acc = horner(c + dx * (dy + 1), dy, vy);
+                for (int r = dx - 1; r >= 0; r--) acc = vadd(vmul(acc, vx), horner(c + r * (dy + 1), dy, vy));
+                store(out + i, acc);
+            }
+            return;
+    }
+}
+
+inline void unary(Op op, double* a, size_t n) {
+    switch (op) {
+        case Op::Neg:  for (size_t i = 0; i < n; i += width) store(a + i, vneg(load(a + i))); break;
+        case Op::Abs:  for (size_t i = 0; i < n; i += width) store(a + i, vabs(load(a + i))); break;
+        case Op::Sqrt: for (size_t i = 0; i < n; i += width) store(a + i, vsqrt(load(a + i))); break;
+        case Op::Sqr:  for (size_t i = 0; i < n; i += width) store(a + i, vmul(load(a + i), load(a + i))); break;
+        case Op::Sin:  for (size_t i = 0; i < n; i++) a[i] = sin(a[i]); break;
+        case Op::Cos:  for (size_t i = 0; i < n; i++) a[i] = cos(a[i]); break;
+        case Op::Exp:  for (size_t i = 0; i < n; i++) a[i] = exp(a[i]); break;
+        case Op::Log:  for (size_t i = 0; i < n; i++) a[i] = safeLog(a[i]); break;
+        default:       for (size_t i = 0; i < n; i++) a[i] = applyFunc(op, a[i]); break;
+    }
+}
+
+}
+
+struct Interval {
+    double lo, hi;
+    
+    Interval() : lo(0), hi(0) {}
+    Interval(double v) : lo(v), hi(v) {}
+    Interval(double l, double h) : lo(l), hi(h) {}
+    
+    static Interval whole() { return Interval(-INFINITY, INFINITY); }
+    bool contains(double v) const { return lo <= v && v <= hi; }
+};
+
+inline Interval hull(double a, double b, double c, double d) {
+    if (std::isnan(a) || std::isnan(b) || std::isnan(c) || std::isnan(d)) return Interval::whole();
+    return Interval(std::min(std::min(a, b), std::min(c, d)), std::max(std::max(a, b), std::max(c, d)));
+}
+
+inline Interval ipowInt(Interval a, int n) {
+    if (n == 0) return Interval(1);
+    double l = pow(a.lo, n), h = pow(a.hi, n);
+    if (n % 2 == 1) return Interval(l, h);
+    if (a.contains(0)) return Interval(0, std::max(l, h));
+    return Interval(std::min(l, h), std::max(l, h));
+}
+
+// Sums the monomials rather than running Horner, so even powers stay non-negative.
+inline Interval polyRange(const double* c, Interval x, Interval y) {
+    int dx = static_cast<int>(c[0]), dy = static_cast<int>(c[1]);
+    c += 2;
+    Interval sum(0);
+    for (int i = 0; i <= dx; i++) {
+        Interval px = ipowInt(x, i);
+        for (int j = 0; j <= dy; j++) {
+            double k = c[i * (dy + 1) + j];
+            if (k == 0) continue;
+            Interval t = ipowInt(y, j);
+            t = hull(px.lo * t.lo, px.lo * t.hi, px.hi * t.lo, px.hi * t.hi);
+            t = k > 0 ? Interval(k * t.lo, k * t.hi) : Interval(k * t.hi, k * t.lo);
+            sum = Interval(sum.lo + t.lo, sum.hi + t.hi);
+        }
+    }
+    if (std::isnan(sum.lo) || std::isnan(sum.hi)) return Interval::whole();
+    return sum;
+}
+
+inline Interval isinRange(Interval a, double phase) {
+    if (!std::isfinite(a.lo) || !std::isfinite(a.hi) || a.hi - a.lo >= 2 * M_PI) return Interval(-1, 1);
+    double l = sin(a.lo + phase), h = sin(a.hi + phase);
+    Interval r(std::min(l, h), std::max(l, h));
+    double peak = ceil((a.lo + phase - M_PI / 2) / (2 * M_PI)) * 2 * M_PI + M_PI / 2;
+    if (peak <= a.hi + phase) r.hi = 1;
+    double trough = ceil((a.lo + phase + M_PI / 2) / (2 * M_PI)) * 2 * M_PI - M_PI / 2;
+    if (trough <= a.hi + phase) r.lo = -1;
+    return r;
+}
+
+inline Interval applyFunc(Op op, Interval a) {
+    switch (op) {
+        case Op::Neg: return Interval(-a.hi, -a.lo);
+        case Op::Sin: return isinRange(a, 0);
+        case Op::Cos: return isinRange(a, M_PI / 2);
+        case Op::Tan: {
+            if (!std::isfinite(a.lo) || !std::isfinite(a.hi) || a.hi - a.lo >= M_PI) return Interval::whole();
+            double pole = ceil((a.lo - M_PI / 2) / M_PI) * M_PI + M_PI / 2;
+            if (pole <= a.hi) return Interval::whole();
+            return Interval(tan(a.lo), tan(a.hi));
+        }
+        case Op::Log:
+            if (a.hi <= 0) return Interval(0);
+            if (a.lo > 0) return Interval(log(a.lo), log(a.hi));
+            return Interval(-INFINITY, std::max(0.0, log(a.hi)));
+        case Op::Sqrt:
+            if (a.hi < 0) return Interval(0);
+            return Interval(a.lo > 0 ? sqrt(a.lo) : 0, sqrt(a.hi));
+        case Op::Exp: return Interval(exp(a.lo), exp(a.hi));
+        case Op::Abs:
+            if (a.lo >= 0) return a;
+            if (a.hi <= 0) return Interval(-a.hi, -a.lo);
+            return Interval(0, std::max(-a.lo, a.hi));
+        case Op::Sqr: return ipowInt(a, 2);
+        default: return Interval::whole();
+    }
+}
+
+inline Interval applyBinary(Op op, Interval a, Interval b) {
+    switch (op) {
+        case Op::Add: return Interval(a.lo + b.lo, a.hi + b.hi);
+        case Op::Sub: return Interval(a.lo - b.hi, a.hi - b.lo);
+        case Op::Mul: return hull(a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi);
+        case Op::Div:
+            if (b.contains(0)) return Interval::whole();
+            return hull(a.lo / b.lo, a.lo / b.hi, a.hi / b.lo, a.hi / b.hi);
+        case Op::Pow:
+            if (b.lo == b.hi && b.lo == floor(b.lo) && fabs(b.lo) < 64) {
+                if (b.lo >= 0) return ipowInt(a, static_cast<int>(b.lo));
+                if (a.contains(0)) return Interval::whole();
+                Interval p = ipowInt(a, static_cast<int>(-b.lo));
+                return hull(1 / p.lo, 1 / p.hi, 1 / p.lo, 1 / p.hi);
+            }
+            if (a.lo > 0) return hull(pow(a.lo, b.lo), pow(a.lo, b.hi), pow(a.hi, b.lo), pow(a.hi, b.hi));
+            return Interval::whole();
+        default: return Interval::whole();
+    }
+}
+
+typedef std::complex<double> Complex;
+
+// Principal branches throughout; unlike the real evaluators nothing is clamped,
+// so log(0) and z/0 come out infinite.
+inline Complex applyFunc(Op op, Complex a) {
+    switch (op) {
+        case Op::Neg:  return -a;
+        case Op::Sin:  return std::sin(a);
+        case Op::Cos:  return std::cos(a);
+        case Op::Tan:  return std::tan(a);
+        case Op::Log:  return std::log(a);
+        case Op::Sqrt: return std::sqrt(a);
+        case Op::Exp:  return std::exp(a);
+        case Op::Abs:  return std::abs(a);
+        case Op::Sqr:  return a * a;
+        default:       return 0;
+    }
+}
+
+inline Complex cpowInt(Complex a, int k) {
+    Complex r = 1;
+    for (int e = k < 0 ? -k : k; e > 0; e >>= 1) {
+        if (e & 1) r *= a;
+        a *= a;
+    }
+    return k < 0 ? 1.0 / r : r;
+}
+
+inline Complex applyBinary(Op op, Complex a, Complex b) {
+    switch (op) {
+        case Op::Add: return a + b;
+        case Op::Sub: return a - b;
+        case Op::Mul: return a * b;
+        case Op::Div: return a / b;
+        case Op::Pow:
+            if (b.imag() == 0 && b.real() == floor(b.real()) && fabs(b.real()) <= 64) {
+                return cpowInt(a, static_cast<int>(b.real()));
+            }
+            if (a == 0.0) return 0;
+            return std::pow(a, b);
+        default: return 0;
+    }
+}
+
+// Argument to hue, modulus to lightness: zeros are black and poles white. The
+// argument comes from a rational atan fit good to a quarter degree, which is
+// plenty for a hue and several times cheaper than atan2.
+inline void domainColor(double re, double im, unsigned char* px) {
+    px[3] = 255;
+    double m = sqrt(re * re + im * im);
+    if (!std::isfinite(m)) {
+        px[0] = px[1] = px[2] = 255;
+        return;
+    }
+    if (m == 0) {
+        px[0] = px[1] = px[2] = 0;
+        return;
+    }
+    double ax = fabs(re), ay = fabs(im);
+    double t = std::min(ax, ay) / std::max(ax, ay);
+    double a = t * (M_PI / 4 + 0.273 * (1 - t));
+    if (ay > ax) a = M_PI / 2 - a;
+    if (re < 0) a = M_PI - a;
+    if (im < 0) a = 2 * M_PI - a;
+    
+    double l = m / (1 + m);
+    double c = 1 - fabs(2 * l - 1);
+    double hp = a * (3 / M_PI);
+    double hue[3] = {fabs(hp - 3) - 1, 2 - fabs(hp - 2), 2 - fabs(hp - 4)};
+    for (int k = 0; k < 3; k++) {
+        double v = l + c * (std::min(1.0, std::max(0.0, hue[k])) - 0.5);
+        px[k] = static_cast<unsigned char>(255 * v + 0.5);
+    }
+}
+
+class Program {
+private:
+    std::vector<Instr> code;
+    std::vector<double> coeffs;
+    int depth;
+    int temps;
+    int outputs;
+    bool hasY;
+    bool cplx;
+    
+    friend class Parser;
+    friend class Optimizer;
+    friend class SessionCache;
+    
+    // Two planes per slot: real parts at [2s * block], imaginary parts at [(2s + 1) * block].
+    static void complexBinary(Op op, double* ar, double* ai, const double* br, const double* bi, size_t n) {
+        using namespace simd;
+        int k;
+        bool realExp = op == Op::Pow && std::all_of(bi, bi + n, [](double v) { return v == 0; });
+        if (realExp && uniformSmallInt(br, n, k)) {
+            for (size_t i = 0; i < n; i += width) {
+                vec xr = load(ar + i), xi = load(ai + i);
+                vec rr = splat(1.0), ri = splat(0.0);
+                for (int e = k; e > 0; e >>= 1) {
+                    if (e & 1) {
+                        vec t = vsub(vmul(rr, xr), vmul(ri, xi));
+                        ri = vadd(vmul(rr, xi), vmul(ri, xr));
+                        rr = t;
+                    }
+                    vec t = vsub(vmul(xr, xr), vmul(xi, xi));
+                    xi = vmul(splat(2.0), vmul(xr, xi));
+                    xr = t;
+                }
+                store(ar + i, rr);
+                store(ai + i, ri);
+            }
+            return;
+        }
+        switch (op) {
+            case Op::Add:
+            case Op::Sub:
+                for (size_t i = 0; i < n; i += width) {
+                    store(ar + i, op == Op::Add ? vadd(load(ar + i), load(br + i)) : vsub(load(ar + i), load(br + i)));
+                    store(ai + i, op == Op::Add ? vadd(load(ai + i), load(bi + i)) : vsub(load(ai + i), load(bi + i)));
+                }
+                break;
+            case Op::Mul:
+                for (size_t i = 0; i < n; i += width) {
+                    vec a = load(ar + i), b = load(ai + i), c = load(br + i), d = load(bi + i);
+                    store(ar + i, vsub(vmul(a, c), vmul(b, d)));
+                    store(ai + i, vadd(vmul(a, d), vmul(b, c)));
+                }
+                break;
+            case Op::Div:
+                for (size_t i = 0; i < n; i += width) {
+                    vec a = load(ar + i), b = load(ai + i), c = load(br + i), d = load(bi + i);
+                    vec den = vadd(vmul(c, c), vmul(d, d));
+                    store(ar + i, vquot(vadd(vmul(a, c), vmul(b, d)), den));
+                    store(ai + i, vquot(vsub(vmul(b, c), vmul(a, d)), den));
+                }
+                break;
+            default:
+                for (size_t i = 0; i < n; i++) {
+                    Complex r = applyBinary(op, Complex(ar[i], ai[i]), Complex(br[i], bi[i]));
+                    ar[i] = r.real();
+                    ai[i] = r.imag();
+                }
+                break;
+        }
+    }
+    
+    static void complexUnary(Op op, double* ar, double* ai, size_t n) {
+        using namespace simd;
+        switch (op) {
+            case Op::Neg:
+                for (size_t i = 0; i < n; i += width) {
+                    store(ar + i, vneg(load(ar + i)));
+                    store(ai + i, vneg(load(ai + i)));
+                }
+                break;
+            case Op::Sqr:
+                for (size_t i = 0; i < n; i += width) {
+                    vec a = load(ar + i), b = load(ai + i);
+                    store(ar + i, vsub(vmul(a, a), vmul(b, b)));
+                    store(ai + i, vmul(splat(2.0), vmul(a, b)));
+                }
+                break;
+            case Op::Abs:
+                for (size_t i = 0; i < n; i += width) {
+                    vec a = load(ar + i), b = load(ai + i);
+                    store(ar + i, vsqrt(vadd(vmul(a, a), vmul(b, b))));
+                    store(ai + i, splat(0.0));
+                }
+                break;
+            default:
+                for (size_t i = 0; i < n; i++) {
+                    Complex r = applyFunc(op, Complex(ar[i], ai[i]));
+                    ar[i] = r.real();
+                    ai[i] = r.imag();
+                }
+                break;
+        }
+    }
+    
+public:
+    Program() : depth(0), temps(0), outputs(1), hasY(false), cplx(false) {}
+    
+    const std::vector<Instr>& instrs() const { return code; }
+    const std::vector<double>& polyBlocks() const { return coeffs; }
+    int stackDepth() const { return depth; }
+    int tempCount() const { return temps; }
+    int outputCount() const { return outputs; }
+    bool usesY() const { return hasY; }
+    bool isComplex() const { return cplx; }
+    
+    double eval(double x, double y = 0) const {
+        double local[32];
+        std::vector<double> spill;
+        double* st = local;
+        if (depth + temps > 32) {
+            spill.resize(depth + temps);
+            st = spill.data();
+        }
+        double* tmp = st + depth;
+        
+        int sp = -1;
+        for (const Instr& in : code) {
+            switch (in.op) {
+                case Op::Const: st[++sp] = in.val; break;
+                case Op::VarX:  st[++sp] = x; break;
+                case Op::VarY:  st[++sp] = y; break;
+                case Op::Poly:  st[++sp] = polyAt(&coeffs[static_cast<size_t>(in.val)], x, y); break;
+                case Op::Load:  st[++sp] = tmp[static_cast<int>(in.val)]; break;
+                case Op::Store: tmp[static_cast<int>(in.val)] = st[sp]; break;
+                case Op::Add: case Op::Sub: case Op::Mul: case Op::Div: case Op::Pow:
+                    sp--;
+                    st[sp] = applyBinary(in.op, st[sp], st[sp + 1]);
+                    break;
+                default:
+                    st[sp] = applyFunc(in.op, st[sp]);
+                    break;
+            }
+        }
+        return sp >= 0 ? st[sp] : 0;
+    }
+    
+    Interval evalInterval(Interval x, Interval y) const {
+        Interval local[32];
+        std::vector<Interval> spill;
+        Interval* st = local;
+        if (depth + temps > 32) {
+            spill.resize(depth + temps);
+            st = spill.data();
+        }
+        Interval* tmp = st + depth;
+        
+        int sp = -1;
+        for (const Instr& in : code) {
+            switch (in.op) {
+                case Op::Const: st[++sp] = Interval(in.val); break;
+                case Op::VarX:  st[++sp] = x; break;
+                case Op::VarY:  st[++sp] = y; break;
+                case Op::Poly:  st[++sp] = polyRange(&coeffs[static_cast<size_t>(in.val)], x, y); break;
+                case Op::Load:  st[++sp] = tmp[static_cast<int>(in.val)]; break;
+                case Op::Store: tmp[static_cast<int>(in.val)] = st[sp]; break;
+                case Op::Add: case Op::Sub: case Op::Mul: case Op::Div: case Op::Pow:
+                    sp--;
+                    st[sp] = applyBinary(in.op, st[sp], st[sp + 1]);
+                    break;
+                default:
+                    st[sp] = applyFunc(in.op, st[sp]);
+                    break;
+            }
+        }
+        return sp >= 0 ? st[sp] : Interval(0);
+    }
+    
+    void evalBatch(const double* xs, const double* ys, double* out, size_t n) const {
+        evalBatch(xs, ys, &out, 1, n);
+    }
+    
+    // Writes the top k stack values, bottom first, so a fused program fills one stream per equation.
+    void evalBatch(const double* xs, const double* ys, double* const* outs, int k, size_t n) const {
+        const size_t block = 256;
+        std::vector<double> regs((std::max(depth + temps, 1) + 2) * block);
+        double* px = &regs[regs.size() - 2 * block];
+        double* py = px + block;
+        
+        for (size_t base = 0; base < n; base += block) {
+            size_t cnt = std::min(block, n - base);
+            size_t lanes = simd::padded(cnt);
+            if (!coeffs.empty()) {
+                std::copy(xs + base, xs + base + cnt, px);
+                std::fill(px + cnt, px + lanes, 0.0);
+                if (ys) {
+                    std::copy(ys + base, ys + base + cnt, py);
+                    std::fill(py + cnt, py + lanes, 0.0);
+                } else {
+                    simd::fill(py, 0, lanes);
+                }
+            }
+            
+            int sp = -1;
+            for (const Instr& in : code) {
+                switch (in.op) {
+                    case Op::Const:
+                        simd::fill(&regs[++sp * block], in.val, lanes);
+                        break;
+                    case Op::VarX:
+                    case Op::VarY: {
+                        const double* src = in.op == Op::VarX ? xs : ys;
+                        double* r = &regs[++sp * block];
+                        if (src) {
+                            std::copy(src + base, src + base + cnt, r);
+                            std::fill(r + cnt, r + lanes, 0.0);
+                        } else {
+                            simd::fill(r, 0, lanes);
+                        }
+                        break;
+                    }
+                    case Op::Poly:
+                        simd::poly(&coeffs[static_cast<size_t>(in.val)], px, py, &regs[++sp * block], lanes);
+                        break;
+                    case Op::Load: {
+                        const double* t = &regs[(depth + static_cast<int>(in.val)) * block];
+                        std::copy(t, t + lanes, &regs[++sp * block]);
+                        break;
+                    }
+                    case Op::Store: {
+                        const double* r = &regs[sp * block];
+                        std::copy(r, r + lanes, &regs[(depth + static_cast<int>(in.val)) * block]);
+                        break;
+                    }
+                    case Op::Add: case Op::Sub: case Op::Mul: case Op::Div: case Op::Pow:
+                        sp--;
+                        simd::binary(in.op, &regs[sp * block], &regs[(sp + 1) * block], lanes);
+                        break;
+                    default:
+                        simd::unary(in.op, &regs[sp * block], lanes);
+                        break;
+                }
+            }
+            
+            for (int o = 0; o < k; o++) {
+                int r = sp - k + 1 + o;
+                if (r >= 0) {
+                    std::copy(&regs[r * block], &regs[r * block] + cnt, outs[o] + base);
+                } else {
+                    std::fill(outs[o] + base, outs[o] + base + cnt, 0.0);
+                }
+            }
+        }
+    }
+    
+    // For programs from Parser::compileComplex: x and y are the real and imaginary
+    // parts of z, and Imag pushes i.
+    Complex evalComplex(Complex z) const {
+        std::vector<Complex> st(std::max(depth + temps, 1) + 1);
+        Complex* tmp = st.data() + depth + 1;
+        int sp = -1;
+        for (const Instr& in : code) {
+            switch (in.op) {
+                case Op::Const: st[++sp] = in.val; break;
+                case Op::VarX:  st[++sp] = z.real(); break;
+                case Op::VarY:  st[++sp] = z.imag(); break;
+                case Op::Imag:  st[++sp] = Complex(0, 1); break;
+                case Op::Load:  st[++sp] = tmp[static_cast<int>(in.val)]; break;
+                case Op::Store: tmp[static_cast<int>(in.val)] = st[sp]; break;
+                case Op::Add: case Op::Sub: case Op::Mul: case Op::Div: case Op::Pow:
+                    sp--;
+                    st[sp] = applyBinary(in.op, st[sp], st[sp + 1]);
+                    break;
+                default:
+                    st[sp] = applyFunc(in.op, st[sp]);
+                    break;
+            }
+        }
+        return sp >= 0 ? st[sp] : 0;
+    }
+    
+    // Arithmetic runs on split real/imaginary planes in SIMD lanes; the
+    // transcendental functions go through std::complex one sample at a time.
+    void evalComplexBatch(const double* re, const double* im, double* outRe, double* outIm, size_t n) const {
+        const size_t block = 256;
+        std::vector<double> regs(2 * (std::max(depth + temps, 1) + 1) * block);
+        auto planes = [&regs, block](int slot) { return &regs[2 * slot * block]; };
+        
+        for (size_t base = 0; base < n; base += block) {
+            size_t cnt = std::min(block, n - base);
+            size_t lanes = simd::padded(cnt);
+            
+            int sp = -1;
+            for (const Instr& in : code) {
+                switch (in.op) {
+                    case Op::Const:
+                    case Op::Imag: {
+                        double* r = planes(++sp);
+                        simd::fill(r, in.op == Op::Const ? in.val : 0, lanes);
+                        simd::fill(r + block, in.op == Op::Imag ? 1 : 0, lanes);
+                        break;
+                    }
+                    case Op::VarX:
+                    case Op::VarY: {
+                        const double* src = in.op == Op::VarX ? re : im;
+                        double* r = planes(++sp);
+                        std::copy(src + base, src + base + cnt, r);
+                        std::fill(r + cnt, r + lanes, 0.0);
+                        simd::fill(r + block, 0, lanes);
+                        break;
+                    }
+                    case Op::Load:
+                    case Op::Store: {
+                        double* t = planes(depth + 1 + static_cast<int>(in.val));
+                        double* r = in.op == Op::Load ? planes(++sp) : planes(sp);
+                        double* from = in.op == Op::Load ? t : r;
+                        double* to = in.op == Op::Load ? r : t;
+                        std::copy(from, from + lanes, to);
+                        std::copy(from + block, from + block + lanes, to + block);
+                        break;
+                    }
+                    case Op::Add: case Op::Sub: case Op::Mul: case Op::Div: case Op::Pow: {
+                        sp--;
+                        double* a = planes(sp);
+                        double* b = planes(sp + 1);
+                        complexBinary(in.op, a, a + block, b, b + block, lanes);
+                        break;
+                    }
+                    default: {
+                        double* a = planes(sp);
+                        complexUnary(in.op, a, a + block, lanes);
+                        break;
+                    }
+                }
+            }
+            
+            if (sp >= 0) {
+                std::copy(planes(sp), planes(sp) + cnt, outRe + base);
+                std::copy(planes(sp) + block, planes(sp) + block + cnt, outIm + base);
+            } else {
+                std::fill(outRe + base, outRe + base + cnt, 0.0);
+                std::fill(outIm + base, outIm + base + cnt, 0.0);
+            }
+        }
+    }
+};
+
+#ifdef MV_HAS_JIT
+class JitFunction {
+private:
+    typedef void (*Fn)(const double*, const double*, double*, size_t);
+    
+    void* mem;
+    size_t size;
+    Fn fn;
+    std::vector<unsigned char> buf;
+    
+    void bytes(std::initializer_list<unsigned char> b) { buf.insert(buf.end(), b); }
+    
+    void imm32(int32_t v) {
+        unsigned char b[4];
+        memcpy(b, &v, 4);
+        buf.insert(buf.end(), b, b + 4);
+    }
+    
+    void imm64(uint64_t v) {
+        unsigned char b[8];
+        memcpy(b, &v, 8);
+        buf.insert(buf.end(), b, b + 8);
+    }
+    
+    static uint64_t bits(double v) {
+        uint64_t b;
+        memcpy(&b, &v, 8);
+        return b;
+    }
+    
+    static unsigned char rbxDisp(int xmm) { return static_cast<unsigned char>(0x83 | (xmm << 3)); }
+    
+    // Each stack slot holds two lanes at [rbx + 16*slot].
+    static int slot(int s) { return 16 * s; }
+    
+    void loadPacked(int xmm, int disp) { bytes({0x66, 0x0F, 0x28, rbxDisp(xmm)}); imm32(disp); }
+    void storePacked(int xmm, int disp) { bytes({0x66, 0x0F, 0x29, rbxDisp(xmm)}); imm32(disp); }
+    void loadLane(int xmm, int disp) { bytes({0xF2, 0x0F, 0x10, rbxDisp(xmm)}); imm32(disp); }
+    void storeLane(int xmm, int disp) { bytes({0xF2, 0x0F, 0x11, rbxDisp(xmm)}); imm32(disp); }
+    
+    void movRax(uint64_t v) { bytes({0x48, 0xB8}); imm64(v); }
+    
+    // xmm1 = {v, v}
+    void splatXmm1(uint64_t v) {
+        movRax(v);
+        bytes({0x66, 0x48, 0x0F, 0x6E, 0xC8});          // movq xmm1, rax
+        bytes({0x66, 0x0F, 0x14, 0xC9});                // unpcklpd xmm1, xmm1
+    }
+    
+    void callLanes(const void* target, int a, int b) {
+        for (int lane = 0; lane < 16; lane += 8) {
+            loadLane(0, a + lane);
+            if (b >= 0) loadLane(1, b + lane);
+            movRax(reinterpret_cast<uint64_t>(target));
+            bytes({0xFF, 0xD0});                        // call rax
+            if (lane == 0) {
+                storeLane(0, a);
+            } else {
+                loadLane(1, a);
+                bytes({0x66, 0x0F, 0x14, 0xC8});        // unpcklpd xmm1, xmm0
+                storePacked(1, a);
+            }
+        }
+    }
+    
+    void release() {
+        if (mem) munmap(mem, size);
+        mem = nullptr;
+        size = 0;
+        fn = nullptr;
+    }
+    
+    bool emitBody(const std::vector<Instr>& code, const std::vector<double>& coeffs, int tempBase) {
+        int sp = -1;
+        for (size_t i = 0; i < code.size(); i++) {
+            const Instr& in = code[i];
+            switch (in.op) {
+                case Op::Const:
+                    sp++;
+                    splatXmm1(bits(in.val));
+                    storePacked(1, slot(sp));
+                    break;
+                case Op::VarX:
+                    sp++;
+                    bytes({0x66, 0x41, 0x0F, 0x10, 0x04, 0x24});        // movupd xmm0, [r12]
+                    storePacked(0, slot(sp));
+                    break;
+                case Op::VarY:
+                    sp++;
+                    bytes({0x66, 0x41, 0x0F, 0x10, 0x45, 0x00});        // movupd xmm0, [r13]
+                    storePacked(0, slot(sp));
+                    break;
+                case Op::Poly: {
+                    sp++;
+                    const double* c = &coeffs[static_cast<size_t>(in.val)];
+                    int dx = static_cast<int>(c[0]), dy = static_cast<int>(c[1]);
+                    c += 2;
+                    bytes({0x66, 0x41, 0x0F, 0x10, 0x04, 0x24});        // movupd xmm0, [r12]
+                    bytes({0x66, 0x41, 0x0F, 0x10, 0x55, 0x00});        // movupd xmm2, [r13]
+                    for (int r = dx; r >= 0; r--) {
+                        const double* row = c + r * (dy + 1);
+                        splatXmm1(bits(row[dy]));
+                        bytes({0x66, 0x0F, 0x28, 0xD9});                // movapd xmm3, xmm1
+                        for (int j = dy - 1; j >= 0; j--) {
+                            splatXmm1(bits(row[j]));
+                            bytes({0x66, 0x0F, 0x59, 0xDA});            // mulpd xmm3, xmm2
+                            bytes({0x66, 0x0F, 0x58, 0xD9});            // addpd xmm3, xmm1
+                        }
+                        if (r == dx) {
+                            bytes({0x66, 0x0F, 0x28, 0xE3});            // movapd xmm4, xmm3
+                        } else {
+                            bytes({0x66, 0x0F, 0x59, 0xE0});            // mulpd xmm4, xmm0
+                            bytes({0x66, 0x0F, 0x58, 0xE3});            // addpd xmm4, xmm3
+                        }
+                    }
+                    storePacked(4, slot(sp));
+                    break;
+                }
+                case Op::Load:
+                    sp++;
+                    loadPacked(0, slot(tempBase + static_cast<int>(in.val)));
+                    storePacked(0, slot(sp));
+                    break;
+                case Op::Store:
+                    loadPacked(0, slot(sp));
+                    storePacked(0, slot(tempBase + static_cast<int>(in.val)));
+                    break;
+                case Op::Sqr:
+                    loadPacked(0, slot(sp));
+                    bytes({0x66, 0x0F, 0x59, 0xC0});                    // mulpd xmm0, xmm0
+                    storePacked(0, slot(sp));
+                    break;
+                case Op::Add:
+                case Op::Sub:
+                case Op::Mul: {
+                    sp--;
+                    unsigned char opc = in.op == Op::Add ? 0x58 : in.op == Op::Sub ? 0x5C : 0x59;
+                    loadPacked(0, slot(sp));
+                    bytes({0x66, 0x0F, opc, rbxDisp(0)}); imm32(slot(sp + 1));
+                    storePacked(0, slot(sp));
+                    break;
+                }
+                case Op::Div:
+                    sp--;
+                    loadPacked(0, slot(sp));
+                    loadPacked(1, slot(sp + 1));
+                    bytes({0x66, 0x0F, 0x57, 0xD2});                    // xorpd xmm2, xmm2
+                    bytes({0x66, 0x0F, 0xC2, 0xD1, 0x04});              // cmpneqpd xmm2, xmm1
+                    bytes({0x66, 0x0F, 0x5E, 0xC1});                    // divpd xmm0, xmm1
+                    bytes({0x66, 0x0F, 0x54, 0xC2});                    // andpd xmm0, xmm2
+                    storePacked(0, slot(sp));
+                    break;
+                case Op::Pow: {
+                    sp--;
+                    const Instr& prev = code[i - 1];
+                    if (prev.op == Op::Const && prev.val == floor(prev.val) && prev.val >= 0 && prev.val <= 16) {
+                        loadPacked(0, slot(sp));
+                        splatXmm1(bits(1.0));
+                        for (int e = static_cast<int>(prev.val); e > 0; e >>= 1) {
+                            if (e & 1) bytes({0x66, 0x0F, 0x59, 0xC8});    // mulpd xmm1, xmm0
+                            bytes({0x66, 0x0F, 0x59, 0xC0});               // mulpd xmm0, xmm0
+                        }
+                        storePacked(1, slot(sp));
+                    } else {
+                        callLanes(reinterpret_cast<const void*>(static_cast<double (*)(double, double)>(pow)),
+                                  slot(sp), slot(sp + 1));
+                    }
+                    break;
+                }
+                case Op::Neg:
+                case Op::Abs:
+                    loadPacked(0, slot(sp));
+                    splatXmm1(in.op == Op::Neg ? 0x8000000000000000ull : 0x7FFFFFFFFFFFFFFFull);
+                    bytes({0x66, 0x0F, static_cast<unsigned char>(in.op == Op::Neg ? 0x57 : 0x54), 0xC1});
+                    storePacked(0, slot(sp));
+                    break;
+                case Op::Sqrt:
+                    loadPacked(0, slot(sp));
+                    bytes({0x66, 0x0F, 0x57, 0xC9});                    // xorpd xmm1, xmm1
+                    bytes({0x66, 0x0F, 0xC2, 0xC8, 0x02});              // cmplepd xmm1, xmm0
+                    bytes({0x66, 0x0F, 0x51, 0xC0});                    // sqrtpd xmm0, xmm0
+                    bytes({0x66, 0x0F, 0x54, 0xC1});                    // andpd xmm0, xmm1
+                    storePacked(0, slot(sp));
+                    break;
+                default: {
+                    double (*f)(double) = nullptr;
+                    switch (in.op) {
+                        case Op::Sin: f = static_cast<double (*)(double)>(sin); break;
+                        case Op::Cos: f = static_cast<double (*)(double)>(cos); break;
+                        case Op::Tan: f = static_cast<double (*)(double)>(tan); break;
+                        case Op::Exp: f = static_cast<double (*)(double)>(exp); break;
+                        case Op::Log: f = safeLog; break;
+                        default: break;
+                    }
+                    if (!f) return false;
+                    callLanes(reinterpret_cast<const void*>(f), slot(sp), -1);
+                    break;
+                }
+            }
+        }
+        
+        if (sp >= 0) {
+            loadPacked(0, slot(sp));
+        } else {
+            bytes({0x66, 0x0F, 0x57, 0xC0});                            // xorpd xmm0, xmm0
+        }
+        bytes({0x66, 0x41, 0x0F, 0x11, 0x06});                          // movupd [r14], xmm0
+        return true;
+    }
+    
+public:
+    JitFunction() : mem(nullptr), size(0), fn(nullptr) {}
+    ~JitFunction() { release(); }
+    
+    JitFunction(const JitFunction&) = delete;
+    JitFunction& operator=(const JitFunction&) = delete;
+    
+    JitFunction(JitFunction&& o) noexcept : mem(o.mem), size(o.size), fn(o.fn) {
+        o.mem = nullptr;
+        o.size = 0;
+        o.fn = nullptr;
+    }
+    
+    JitFunction& operator=(JitFunction&& o) noexcept {
+        if (this != &o) {
+            release();
+            std::swap(mem, o.mem);
+            std::swap(size, o.size);
+            std::swap(fn, o.fn);
+        }
+        return *this;
+    }
+    
+    bool ready() const { return fn != nullptr; }
+    
+    // Emits fn(xs, ys, out, n) for even n, two samples per iteration.
+    bool compile(const Program& prog) {
+        release();
+        buf.clear();
+        
+        int frame = 16 * std::max(prog.stackDepth() + prog.tempCount(), 1);
+        
+        bytes({0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});  // push rbx, r12-r15
+        bytes({0x48, 0x81, 0xEC}); imm32(frame);                        // sub rsp, frame
+        bytes({0x48, 0x89, 0xE3});                                      // mov rbx, rsp
+        bytes({0x49, 0x89, 0xFC, 0x49, 0x89, 0xF5});                    // mov r12, rdi; mov r13, rsi
+        bytes({0x49, 0x89, 0xD6, 0x49, 0x89, 0xCF});                    // mov r14, rdx; mov r15, rcx
+        bytes({0x4D, 0x85, 0xFF});                                      // test r15, r15
+        bytes({0x0F, 0x84}); size_t skip = buf.size(); imm32(0);        // jz end
+        
+        size_t top = buf.size();
+        if (!emitBody(prog.instrs(), prog.polyBlocks(), prog.stackDepth())) {
+            buf.clear();
+            return false;
+        }
+        bytes({0x49, 0x83, 0xC4, 0x10, 0x49, 0x83, 0xC5, 0x10});        // add r12, 16; add r13, 16
+        bytes({0x49, 0x83, 0xC6, 0x10, 0x49, 0x83, 0xEF, 0x02});        // add r14, 16; sub r15, 2
+        bytes({0x0F, 0x85}); imm32(static_cast<int32_t>(top - (buf.size() + 4)));   // jnz top
+        
+        int32_t rel = static_cast<int32_t>(buf.size() - (skip + 4));
+        memcpy(&buf[skip], &rel, 4);
+        bytes({0x48, 0x81, 0xC4}); imm32(frame);                        // add rsp, frame
+        bytes({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B});  // pop r15-r12, rbx
+        bytes({0xC3});
+        
+        size_t page = 4096;
+        size_t len = (buf.size() + page - 1) / page * page;
+        void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return false;
+        memcpy(p, buf.data(), buf.size());
+        if (mprotect(p, len, PROT_READ | PROT_EXEC) != 0) {
+            munmap(p, len);
+            return false;
+        }
+        
+        mem = p;
+        size = len;
+        fn = reinterpret_cast<Fn>(p);
+        buf.clear();
+        buf.shrink_to_fit();
+        return true;
+    }
+    
+    void evalBatch(const double* xs, const double* ys, double* out, size_t n) const {
+        double zeros[2] = {0, 0};
+        size_t even = n & ~static_cast<size_t>(1);
+        if (!ys) {
+            for (size_t i = 0; i < even; i += 2) fn(xs + i, zeros, out + i, 2);
+        } else {
+            fn(xs, ys, out, even);
+        }
+        if (even < n) {
+            double tx[2] = {xs[even], 0}, ty[2] = {ys ? ys[even] : 0, 0}, to[2];
+            fn(tx, ty, to, 2);
+            out[even] = to[0];
+        }
+    }
+    
+    double operator()(double x, double y = 0) const {
+        double tx[2] = {x, 0}, ty[2] = {y, 0}, to[2];
+        fn(tx, ty, to, 2);
+        return to[0];
+    }
+};
+#endif
+
+// Rebuilds a program as a hash-consed DAG. Constants are folded, identities that
+// hold for every input are applied, and subexpressions used more than once are
+// kept in temps so each sample computes them a single time. Polynomial subtrees
+// in x and y that Horner's scheme evaluates in fewer operations, counting a
+// power as a pow call, become a single Poly instruction over a coefficient block.
+class Optimizer {
+private:
+    struct Node {
+        Op op;
+        double val;
+        int a, b;
+    };
+    
+    struct Poly {
+        int dx = 0, dy = 0;
+        std::vector<double> c = {0};
+        
+        double& at(int i, int j) { return c[i * (dy + 1) + j]; }
+        double at(int i, int j) const { return c[i * (dy + 1) + j]; }
+        
+        bool monomial() const {
+            int nonzero = 0;
+            for (double v : c) nonzero += v != 0;
+            return nonzero == 1;
+        }
+    };
+    
+    static const int maxDegree = 16;
+    static const int powCost = 8;
+    
+    struct Key {
+        Op op;
+        uint64_t bits;
+        int a, b;
+        
+        bool operator==(const Key& o) const { return op == o.op && bits == o.bits && a == o.a && b == o.b; }
+    };
+    
+    struct KeyHash {
+        size_t operator()(const Key& k) const {
+            return std::hash<uint64_t>()(k.bits ^ (static_cast<uint64_t>(k.op) << 56) ^
+                                         static_cast<uint64_t>(k.a) * 0x9E3779B97F4A7C15ull ^
+                                         static_cast<uint64_t>(k.b) * 0xC2B2AE3D27D4EB4Full);
+        }
+    };
+    
+    std::vector<Node> nodes;
+    std::unordered_map<Key, int, KeyHash> index;
+    std::vector<int> uses, slotOf;
+    std::vector<char> emitted;
+    std::vector<double> pool;
+    std::map<std::vector<double>, int> blocks;
+    
+    static bool isLeaf(Op op) { return op == Op::Const || op == Op::VarX || op == Op::VarY || op == Op::Poly; }
+    
+    static bool isBinary(Op op) {
+        return op == Op::Add || op == Op::Sub || op == Op::Mul || op == Op::Div || op == Op::Pow;
+    }
+    
+    int intern(Op op, double val, int a = -1, int b = -1) {
+        uint64_t bits;
+        memcpy(&bits, &val, 8);
+        Key k = {op, bits, a, b};
+        auto it = index.find(k);
+        if (it != index.end()) return it->second;
+        nodes.push_back({op, val, a, b});
+        index.emplace(k, static_cast<int>(nodes.size() - 1));
+        return static_cast<int>(nodes.size() - 1);
+    }
+    
+    bool isConst(int n, double v) const { return nodes[n].op == Op::Const && nodes[n].val == v; }
+    
+    int make(Op op, double val, int a, int b) {
+        if (isLeaf(op)) return intern(op, val);
+        
+        Node na = nodes[a];
+        if (!isBinary(op)) {
+            if (na.op == Op::Const) return intern(Op::Const, applyFunc(op, na.val));
+            if (op == Op::Neg && na.op == Op::Neg) return na.a;
+            return intern(op, 0, a);
+        }
+        
+        Node nb = nodes[b];
+        if (na.op == Op::Const && nb.op == Op::Const) return intern(Op::Const, applyBinary(op, na.val, nb.val));
+        switch (op) {
+            case Op::Add:
+                if (isConst(b, 0)) return a;
+                if (isConst(a, 0)) return b;
+                break;
+            case Op::Sub:
+                if (isConst(b, 0)) return a;
+                break;
+            case Op::Mul:
+                if (isConst(b, 1)) return a;
+                if (isConst(a, 1)) return b;
+                break;
+            case Op::Div:
+                if (isConst(b, 1)) return a;
+                break;
+            case Op::Pow:
+                if (isConst(b, 0)) return intern(Op::Const, 1);
+                if (isConst(b, 1)) return a;
+                if (isConst(b, 2)) return intern(Op::Sqr, 0, a);
+                break;
+            default:
+                break;
+        }
+        return intern(op, 0, a, b);
+    }
+    
+    int addBlock(const double* c) {
+        size_t len = 2 + static_cast<size_t>(c[0] + 1) * static_cast<size_t>(c[1] + 1);
+        std::vector<double> b(c, c + len);
+        auto it = blocks.find(b);
+        if (it != blocks.end()) return it->second;
+        int off = static_cast<int>(pool.size());
+        pool.insert(pool.end(), b.begin(), b.end());
+        blocks.emplace(b, off);
+        return off;
+    }
+    
+    static Poly resized(const Poly& p, int dx, int dy) {
+        Poly r;
+        r.dx = dx;
+        r.dy = dy;
+        r.c.assign((dx + 1) * (dy + 1), 0);
+        for (int i = 0; i <= p.dx; i++) {
+            for (int j = 0; j <= p.dy; j++) r.at(i, j) = p.at(i, j);
+        }
+        return r;
+    }
+    
+    static bool multiply(const Poly& a, const Poly& b, Poly& out) {
+        if (a.dx + b.dx > maxDegree || a.dy + b.dy > maxDegree) return false;
+        Poly r = resized(Poly(), a.dx + b.dx, a.dy + b.dy);
+        for (int i = 0; i <= a.dx; i++) {
+            for (int j = 0; j <= a.dy; j++) {
+                if (a.at(i, j) == 0) continue;
+                for (int k = 0; k <= b.dx; k++) {
+                    for (int l = 0; l <= b.dy; l++) r.at(i + k, j + l) += a.at(i, j) * b.at(k, l);
+                }
+            }
+        }
+        out = r;
+        return true;
+    }
+    
+    // The polynomial a node computes, if it is one. Integer powers of sums are
+    // only expanded while the degree stays small; expanding (x - 1)^10 would
+    // trade pow for cancellation near x = 1.
+    bool polyOf(const Node& nd, const std::vector<Poly>& ps, const std::vector<char>& isPoly, Poly& out) const {
+        switch (nd.op) {
+            case Op::Const: out = Poly(); out.c[0] = nd.val; return true;
+            case Op::VarX: out = resized(Poly(), 1, 0); out.at(1, 0) = 1; return true;
+            case Op::VarY: out = resized(Poly(), 0, 1); out.at(0, 1) = 1; return true;
+            case Op::Poly: {
+                const double* c = &pool[static_cast<size_t>(nd.val)];
+                out = resized(Poly(), static_cast<int>(c[0]), static_cast<int>(c[1]));
+                std::copy(c + 2, c + 2 + out.c.size(), out.c.begin());
+                return true;
+            }
+            default: break;
+        }
+        if (!isPoly[nd.a] || (nd.b >= 0 && !isPoly[nd.b])) return false;
+        const Poly& a = ps[nd.a];
+        switch (nd.op) {
+            case Op::Neg:
+                out = a;
+                for (double& v : out.c) v = -v;
+                return true;
+            case Op::Sqr:
+                return multiply(a, a, out);
+            case Op::Add:
+            case Op::Sub: {
+                const Poly& b = ps[nd.b];
+                out = resized(a, std::max(a.dx, b.dx), std::max(a.dy, b.dy));
+                double sign = nd.op == Op::Add ? 1 : -1;
+                for (int i = 0; i <= b.dx; i++) {
+                    for (int j = 0; j <= b.dy; j++) out.at(i, j) += sign * b.at(i, j);
+                }
+                return true;
+            }
+            case Op::Mul:
+                return multiply(a, ps[nd.b], out);
+            case Op::Div: {
+                const Node& nb = nodes[nd.b];
+                if (nb.op != Op::Const || nb.val == 0) return false;
+                out = a;
+                for (double& v : out.c) v /= nb.val;
+                return true;
+            }
+            case Op::Pow: {
+                const Node& nb = nodes[nd.b];
+                if (nb.op != Op::Const || nb.val != floor(nb.val) || nb.val < 0 || nb.val > maxDegree) return false;
+                int k = static_cast<int>(nb.val);
+                if (!a.monomial() && (a.dx + a.dy) * k > 4) return false;
+                out = Poly();
+                out.c[0] = 1;
+                for (int e = 0; e < k; e++) {
+                    if (!multiply(out, a, out)) return false;
+                }
+                return true;
+            }
+            default:
+                return false;
+        }
+    }
+    
+    // Maps every node to its replacement; polynomial subtrees worth a kernel become Poly leaves.
+    int collapse(int root) {
+        size_t n = nodes.size();
+        std::vector<Poly> ps(n);
+        std::vector<char> isPoly(n, 0);
+        std::vector<int> ops(n, 0), done(n, -1);
+        for (size_t i = 0; i < n; i++) {
+            const Node& nd = nodes[i];
+            isPoly[i] = polyOf(nd, ps, isPoly, ps[i]);
+            if (isLeaf(nd.op)) continue;
+            int own = nd.op == Op::Pow ? powCost : 1;
+            ops[i] = std::min(1 << 20, own + ops[nd.a] + (nd.b >= 0 ? ops[nd.b] : 0));
+        }
+        
+        std::function<int(int)> visit = [&](int i) {
+            if (done[i] >= 0) return done[i];
+            Node nd = nodes[i];
+            int r = i;
+            if (!isLeaf(nd.op)) {
+                const Poly& p = ps[i];
+                int horner = 2 * ((p.dx + 1) * (p.dy + 1) - 1);
+                if (isPoly[i] && p.dx + p.dy > 0 && horner <= ops[i]) {
+                    std::vector<double> b = {static_cast<double>(p.dx), static_cast<double>(p.dy)};
+                    b.insert(b.end(), p.c.begin(), p.c.end());
+                    r = intern(Op::Poly, addBlock(b.data()));
+                } else {
+                    int a = visit(nd.a);
+                    int b = nd.b >= 0 ? visit(nd.b) : -1;
+                    r = make(nd.op, nd.val, a, b);
+                }
+            }
+            done[i] = r;
+            return r;
+        };
+        return visit(root);
+    }
+    
+    void count(int n) {
+        if (uses[n]++ > 0) return;
+        if (nodes[n].a >= 0) count(nodes[n].a);
+        if (nodes[n].b >= 0) count(nodes[n].b);
+    }
+    
+    void emit(Program& p, int n, int& sp) {
+        const Node& nd = nodes[n];
+        if (slotOf[n] >= 0 && emitted[n]) {
+            p.code.push_back({Op::Load, static_cast<double>(slotOf[n])});
+            p.depth = std::max(p.depth, ++sp);
+            return;
+        }
+        
+        if (isLeaf(nd.op)) {
+            p.code.push_back({nd.op, nd.val});
+            p.depth = std::max(p.depth, ++sp);
+        } else {
+            emit(p, nd.a, sp);
+            if (nd.b >= 0) {
+                emit(p, nd.b, sp);
+                sp--;
+            }
+            p.code.push_back({nd.op, 0});
+        }
+        
+        if (slotOf[n] >= 0) {
+            p.code.push_back({Op::Store, static_cast<double>(slotOf[n])});
+            emitted[n] = 1;
+        }
+    }
+    
+    // Store and Load map back to the node whose value the temp holds, so inputs
+    // that were already optimized rebuild into the same DAG.
+    int build(const Program& in) {
+        std::vector<int> st, temp(static_cast<size_t>(std::max(0, in.temps)), -1);
+        for (const Instr& i : in.code) {
+            if (i.op == Op::Store || i.op == Op::Load) {
+                size_t slot = static_cast<size_t>(i.val);
+                if (i.val < 0 || slot >= temp.size()) return -1;
+                if (i.op == Op::Store) {
+                    if (st.empty()) return -1;
+                    temp[slot] = st.back();
+                } else {
+                    if (temp[slot] < 0) return -1;
+                    st.push_back(temp[slot]);
+                }
+            } else if (i.op == Op::Poly) {
+                st.push_back(intern(Op::Poly, addBlock(&in.coeffs[static_cast<size_t>(i.val)])));
+            } else if (isLeaf(i.op)) {
+                st.push_back(make(i.op, i.val, -1, -1));
+            } else if (isBinary(i.op)) {
+                if (st.size() < 2) return -1;
+                int b = st.back();
+                st.pop_back();
+                st.back() = make(i.op, 0, st.back(), b);
+            } else {
+                if (st.empty() || i.op == Op::Imag) return -1;
+                st.back() = make(i.op, 0, st.back(), -1);
+            }
+        }
+        return st.size() == 1 ? collapse(st[0]) : -1;
+    }
+    
+    Program assemble(const std::vector<int>& roots, bool hasY) {
+        uses.assign(nodes.size(), 0);
+        slotOf.assign(nodes.size(), -1);
+        emitted.assign(nodes.size(), 0);
+        for (int r : roots) count(r);
+        
+        Program out;
+        out.hasY = hasY;
+        out.outputs = static_cast<int>(roots.size());
+        out.coeffs = pool;
+        for (size_t n = 0; n < nodes.size(); n++) {
+            if (uses[n] > 1 && (!isLeaf(nodes[n].op) || nodes[n].op == Op::Poly)) slotOf[n] = out.temps++;
+        }
+        int sp = 0;
+        for (int r : roots) emit(out, r, sp);
+        return out;
+    }
+    
+public:
+    Program run(const Program& in) {
+        int root = build(in);
+        if (root < 0) return in;
+        return assemble({root}, in.hasY);
+    }
+    
+    // One program over a shared DAG that leaves every input's result on the stack,
+    // bottom to top in input order. Returns an empty program if any input is malformed.
+    Program fuse(const std::vector<const Program*>& progs) {
+        std::vector<int> roots;
+        bool hasY = false;
+        for (const Program* p : progs) {
+            int root = build(*p);
+            if (root < 0) return Program();
+            roots.push_back(root);
+            hasY = hasY || p->hasY;
+        }
+        return assemble(roots, hasY);
+    }
+};
+
+// Named parameters and one-line helper functions shared by every equation. Each
+// function records the names its body reads, so a change can be traced through
+// the definitions to exactly the equations it reaches.
+struct Symbols {
+    struct Param {
+        double value, lo, hi;
+    };
+    
+    struct Func {
+        std::vector<std::string> args;
+        std::string body;
+        std::set<std::string> uses;
+    };
+    
+    std::map<std::string, Param> params;
+    std::map<std::string, Func> funcs;
+    
+    bool defined(const std::string& n) const { return params.count(n) || funcs.count(n); }
+    
+    bool reaches(const std::set<std::string>& uses, const std::string& name, int depth = 0) const {
+        for (const std::string& u : uses) {
+            if (u == name) return true;
+            auto f = funcs.find(u);
+            if (f != funcs.end() && depth < 16 && reaches(f->second.uses, name, depth + 1)) return true;
+        }
+        return false;
+    }
+};
+
+class Parser {
+private:
+    static const int maxNesting = 8;
+    
+    std::string expr;
+    size_t pos;
+    Program* prog;
+    int sp;
+    const Symbols* sym;
+    std::set<std::string>* used;
+    std::set<std::string>* unknown;
+    std::vector<std::map<std::string, std::vector<Instr>>> frames;
+    bool complexMode;
+    
+    void emit(Op op, double val = 0) {
+        prog->code.push_back({op, val});
+        if (op == Op::Const || op == Op::VarX || op == Op::VarY || op == Op::Imag) {
+            sp++;
+        } else if (op == Op::Add || op == Op::Sub || op == Op::Mul || op == Op::Div || op == Op::Pow) {
+            sp--;
+        }
+        prog->depth = std::max(prog->depth, sp);
+        if (op == Op::VarY) prog->hasY = true;
+    }
+    
+    // Longest of the built-in, argument and defined names at pos, else one character.
+    std::string getName() {
+        static const char* names[] = {"sqrt", "sin", "cos", "tan", "log", "exp", "abs", "pi", "e", "x", "y"};
+        size_t best = 0;
+        auto consider = [&](const std::string& n) {
+            if (n.size() > best && expr.compare(pos, n.size(), n) == 0) best = n.size();
+        };
+        for (const char* n : names) consider(n);
+        if (!frames.empty()) {
+            for (const auto& a : frames.back()) consider(a.first);
+        }
+        if (sym) {
+            for (const auto& p : sym->params) consider(p.first);
+            for (const auto& f : sym->funcs) consider(f.first);
+        }
+        if (best == 0) best = 1;
+        pos += best;
+        return expr.substr(pos - best, best);
+    }
+    
+    void getNum() {
+        size_t start = pos;
+        while (pos < expr.length() && (isdigit(expr[pos]) || expr[pos] == '.')) pos++;
+        emit(Op::Const, std::stod(expr.substr(start, pos - start)));
+    }
+    
+    // Inlines a helper function: arguments are compiled on their own, then the body
+    // is parsed with each argument name standing for its code.
+    void getCall(const Symbols::Func& f, bool hasArgs) {
+        std::map<std::string, std::vector<Instr>> frame;
+        size_t k = 0;
+        while (hasArgs && pos < expr.length() && expr[pos] != ')') {
+            size_t mark = prog->code.size();
+            int markSp = sp;
+            getExpr();
+            if (k < f.args.size()) {
+                frame[f.args[k]].assign(prog->code.begin() + mark, prog->code.end());
+            }
+            k++;
+            prog->code.resize(mark);
+            sp = markSp;
+            if (pos < expr.length() && expr[pos] == ',') {
+                pos++;
+            } else {
+                break;
+            }
+        }
+        if (hasArgs && pos < expr.length() && expr[pos] == ')') pos++;
+        for (; k < f.args.size(); k++) frame[f.args[k]] = {{Op::Const, 0}};
+        
+        if (static_cast<int>(frames.size()) >= maxNesting) {
+            emit(Op::Const, 0);
+            return;
+        }
+        std::string outer = expr;
+        size_t outerPos = pos;
+        expr = f.body;
+        pos = 0;
+        frames.push_back(std::move(frame));
+        getExpr();
+        frames.pop_back();
+        expr = outer;
+        pos = outerPos;
+    }
+    
+    void getPrimary() {
+        if (pos >= expr.length()) {
+            emit(Op::Const, 0);
+            return;
+        }
+        
+        if (expr[pos] == '(') {
+            pos++;
+            getExpr();
+            if (pos < expr.length() && expr[pos] == ')') pos++;
+            return;
+        }
+        
+        if (isdigit(expr[pos]) || expr[pos] == '.') {
+            getNum();
+            return;
+        }
+        
+        if (isalpha(expr[pos])) {
+            std::string var = getName();
+            
+            if (!frames.empty()) {
+                auto a = frames.back().find(var);
+                if (a != frames.back().end()) {
+                    for (const Instr& in : a->second) emit(in.op, in.val);
+                    return;
+                }
+            }
+            if (var == "x") { emit(Op::VarX); return; }
+            if (var == "y") { emit(Op::VarY); return; }
+            if (complexMode && var == "i") { emit(Op::Imag); return; }
+            if (complexMode && var == "z") {
+                emit(Op::VarX);
+                emit(Op::Imag);
+                emit(Op::VarY);
+                emit(Op::Mul);
+                emit(Op::Add);
+                return;
+            }
+            if (var == "pi") { emit(Op::Const, M_PI); return; }
+            if (var == "e") { emit(Op::Const, M_E); return; }
+            
+            if (sym) {
+                auto p = sym->params.find(var);
+                if (p != sym->params.end()) {
+                    if (used) used->insert(var);
+                    emit(Op::Const, p->second.value);
+                    return;
+                }
+                auto f = sym->funcs.find(var);
+                if (f != sym->funcs.end()) {
+                    if (used) used->insert(var);
+                    bool hasArgs = pos < expr.length() && expr[pos] == '(';
+                    if (hasArgs) pos++;
+                    getCall(f->second, hasArgs);
+                    return;
+                }
+            }
+            
+            if (pos < expr.length() && expr[pos] == '(') {
+                size_t open = ++pos;
+                size_t mark = prog->code.size();
+                int markSp = sp;
+                getExpr();
+                if (pos < expr.length() && expr[pos] == ')') pos++;
+                
+                if (var == "sin") { emit(Op::Sin); return; }
+                if (var == "cos") { emit(Op::Cos); return; }
+                if (var == "tan") { emit(Op::Tan); return; }
+                if (var == "log") { emit(Op::Log); return; }
+                if (var == "sqrt") { emit(Op::Sqrt); return; }
+                if (var == "exp") { emit(Op::Exp); return; }
+                if (var == "abs") { emit(Op::Abs); return; }
+                
+                prog->code.resize(mark);
+                sp = markSp;
+                
+                // An undefined one-letter name before a group is a parameter, and
+                // the group multiplies it as it would once the parameter exists.
+                if (var.size() == 1) {
+                    if (unknown) unknown->insert(var);
+                    if (used) used->insert(var);
+                    emit(Op::Const, 0);
+                    pos = open - 1;
+                    return;
+                }
+            } else if (unknown && var.size() == 1) {
+                unknown->insert(var);
+            }
+            if (used) used->insert(var);
+            emit(Op::Const, 0);
+            return;
+        }
+        emit(Op::Const, 0);
+    }
+
+    void getPower() {
+        getPrimary();
+        if (pos < expr.length() && expr[pos] == '^') {
+            pos++;
+            getUnary();
+            emit(Op::Pow);
+        }
+    }
+    
+    void getUnary() {
+        if (pos < expr.length() && expr[pos] == '-') {
+            pos++;
+            getUnary();
+            emit(Op::Neg);
+        } else if (pos < expr.length() && expr[pos] == '+') {
+            pos++;
+            getUnary();
+        } else {
+            getPower();
+        }
+    }
+    
+    void getTerm() {
+        getUnary();
+        while (pos < expr.length()) {
+            char c = expr[pos];
+            if (c == '*') {
+                pos++;
+                getUnary();
+                emit(Op::Mul);
+            } else if (c == '/') {
+                pos++;
+                getUnary();
+                emit(Op::Div);
+            } else if (c == '(' || c == '.' || isalnum(c)) {
+                getPower();
+                emit(Op::Mul);
+            } else {
+                break;
+            }
+        }
+    }
+    
+    void getExpr() {
+        getTerm();
+        while (pos < expr.length()) {
+            if (expr[pos] == '+') {
+                pos++;
+                getTerm();
+                emit(Op::Add);
+            } else if (expr[pos] == '-') {
+                pos++;
+                getTerm();
+                emit(Op::Sub);
+            } else {
+                break;
+            }
+        }
+    }
+    
+    Program run(const std::string& expression) {
+        Program result;
+        try {
+            expr = expression;
+            expr.erase(std::remove(expr.begin(), expr.end(), ' '), expr.end());
+            pos = 0;
+            sp = 0;
+            prog = &result;
+            getExpr();
+        } catch (...) {
+            result = Program();
+        }
+        prog = nullptr;
+        return result;
+    }
+    
+public:
+    Parser() : pos(0), prog(nullptr), sp(0), sym(nullptr), used(nullptr), unknown(nullptr), complexMode(false) {}
+    
+    Program compile(const std::string& expression) const {
+        Parser local;
+        return Optimizer().run(local.run(expression));
+    }
+    
+    // Defined names are substituted. Every name read goes to uses, including ones not
+    // defined yet, and single-letter names that mean nothing go to unknown (they
+    // still evaluate to 0).
+    Program compile(const std::string& expression, const Symbols& symbols,
+                    std::set<std::string>* uses = nullptr, std::set<std::string>* unknownNames = nullptr) const {
+        Parser local;
+        local.sym = &symbols;
+        local.used = uses;
+        local.unknown = unknownNames;
+        return Optimizer().run(local.run(expression));
+    }
+    
+    // A function of z = x + iy for Program::evalComplex. i is the imaginary unit.
+    // The result is not optimized: the Optimizer folds with real arithmetic.
+    Program compileComplex(const std::string& expression, const Symbols& symbols,
+                           std::set<std::string>* uses = nullptr, std::set<std::string>* unknownNames = nullptr) const {
+        Parser local;
+        local.sym = &symbols;
+        local.used = uses;
+        local.unknown = unknownNames;
+        local.complexMode = true;
+        Program p = local.run(expression);
+        p.cplx = true;
+        p.hasY = true;
+        return p;
+    }
+    
+    double eval(const std::string& expression, double x, double y = 0) const {
+        return compile(expression).eval(x, y);
+    }
+    
+    // Applies "name = expr" or "name(a, b) = expr". A constant right-hand side sets a
+    // parameter; anything that reads other names becomes a function of no arguments.
+    // Returns false, leaving symbols alone, if the line is not a definition.
+    bool define(const std::string& line, Symbols& symbols, std::string& name) const {
+        std::string text = line;
+        text.erase(std::remove(text.begin(), text.end(), ' '), text.end());
+        size_t eq = text.find('=');
+        if (eq == std::string::npos || eq == 0) return false;
+        std::string lhs = text.substr(0, eq), rhs = text.substr(eq + 1);
+        
+        std::vector<std::string> args;
+        size_t open = lhs.find('(');
+        name = lhs.substr(0, open);
+        if (open != std::string::npos) {
+            if (lhs.back() != ')') return false;
+            std::string list = lhs.substr(open + 1, lhs.size() - open - 2);
+            for (size_t a = 0; a <= list.size() && !list.empty();) {
+                size_t b = std::min(list.find(',', a), list.size());
+                args.push_back(list.substr(a, b - a));
+                a = b + 1;
+            }
+        }
+        
+        static const char* reserved[] = {"sqrt", "sin", "cos", "tan", "log", "exp", "abs", "pi", "e", "x", "y"};
+        auto valid = [](const std::string& n) {
+            if (n.empty() || !isalpha(n[0])) return false;
+            for (char c : n) {
+                if (!isalnum(c)) return false;
+            }
+            for (const char* r : reserved) {
+                if (n == r) return false;
+            }
+            return true;
+        };
+        if (!valid(name) || rhs.empty()) return false;
+        for (const std::string& a : args) {
+            if (a.empty() || !isalpha(a[0])) return false;
+        }
+        
+        Symbols::Func f;
+        f.args = args;
+        f.body = rhs;
+        Parser local;
+        local.sym = &symbols;
+        local.used = &f.uses;
+        std::map<std::string, std::vector<Instr>> frame;
+        for (const std::string& a : args) frame[a] = {{Op::VarX, 0}};
+        local.frames.push_back(frame);
+        Program body = local.run(rhs);
+        f.uses.erase(name);
+        
+        bool constant = args.empty() && f.uses.empty() && !body.usesY();
+        for (const Instr& in : body.instrs()) constant = constant && in.op != Op::VarX;
+        if (constant) {
+            double v = Optimizer().run(body).eval(0);
+            Symbols::Param& p = symbols.params[name];
+            symbols.funcs.erase(name);
+            if (p.lo == p.hi) {
+                p.lo = -10;
+                p.hi = 10;
+            }
+            p.value = v;
+            p.lo = std::min(p.lo, v);
+            p.hi = std::max(p.hi, v);
+        } else {
+            symbols.params.erase(name);
+            symbols.funcs[name] = f;
+        }
+        return true;
+    }
+};
+
+struct CurvePoint {
+    double x, y;
+};
+
+struct CurveSpan {
+    double a, fa, b, fb;
+    int depth;
+    size_t owner;
+};
+
+struct Counter {
+    std::atomic<size_t> n;
+    
+    Counter(size_t v = 0) : n(v) {}
+    Counter(const Counter& o) : n(o.n.load()) {}
+    Counter& operator=(const Counter& o) { n = o.n.load(); return *this; }
+    Counter& operator=(size_t v) { n = v; return *this; }
+    
+    operator size_t() const { return n.load(std::memory_order_relaxed); }
+    size_t operator+=(size_t v) { return n.fetch_add(v, std::memory_order_relaxed) + v; }
+};
+
+// Scoped timers feeding an optional trace; when disabled a scope costs one relaxed load.
+class Profiler {
+public:
+    struct Event {
+        const char* name;
+        std::string detail;
+        unsigned tid;
+        int64_t start, dur;
+    };
+    
+private:
+    std::atomic<bool> on;
+    std::mutex lock;
+    std::vector<Event> events;
+    size_t dropped;
+    std::chrono::steady_clock::time_point epoch;
+    
+    static const size_t maxEvents = 1 << 20;
+    
+    Profiler() : on(false), dropped(0), epoch(std::chrono::steady_clock::now()) {}
+    
+    static unsigned threadId() {
+        static std::atomic<unsigned> next(0);
+        static thread_local unsigned id = next++;
+        return id;
+    }
+    
+public:
+    static Profiler& get() {
+        static Profiler p;
+        return p;
+    }
+    
+    bool enabled() const { return on.load(std::memory_order_relaxed); }
+    
+    void enable(bool e) {
+        std::lock_guard<std::mutex> lk(lock);
+        if (e && !on) {
+            events.clear();
+            dropped = 0;
+        }
+        on = e;
+    }
+    
+    int64_t now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+    
+    void record(const char* name, const std::string* detail, int64_t start, int64_t end) {
+        unsigned tid = threadId();
+        std::lock_guard<std::mutex> lk(lock);
+        if (events.size() >= maxEvents) {
+            dropped++;
+            return;
+        }
+        events.push_back({name, detail ? *detail : std::string(), tid, start, end - start});
+    }
+    
+    // Chrome trace-event format; open with chrome://tracing or Perfetto.
+    bool writeTrace(const std::string& path) {
+        FILE* f = fopen(path.c_str(), "w");
+        if (!f) return false;
+        std::lock_guard<std::mutex> lk(lock);
+        fprintf(f, "{\"traceEvents\":[\n");
+        for (size_t i = 0; i < events.size(); i++) {
+            const Event& e = events[i];
+            std::string detail;
+            for (char c : e.detail) {
+                if (c == '"' || c == '\\') detail += '\\';
+                if (static_cast<unsigned char>(c) >= 0x20) detail += c;
+            }
+            fprintf(f, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"eq\":\"%s\"}}%s\n",
+                    e.name, e.tid, e.start / 1000.0, e.dur / 1000.0, detail.c_str(), i + 1 < events.size() ? "," : "");
+        }
+        fprintf(f, "],\"otherData\":{\"dropped\":%zu}}\n", dropped);
+        return fclose(f) == 0;
+    }
+};
+
+class ProfileScope {
+private:
+    const char* name;
+    const std::string* detail;
+    Counter* acc;
+    int64_t start;
+    
+public:
+    ProfileScope(const char* n, const std::string* d = nullptr, Counter* a = nullptr)
+        : name(n), detail(d), acc(a), start(Profiler::get().enabled() ? Profiler::get().now() : -1) {}
+    
+    ~ProfileScope() {
+        if (start < 0) return;
+        int64_t end = Profiler::get().now();
+        if (acc) *acc += static_cast<size_t>(end - start);
+        Profiler::get().record(name, detail, start, end);
+    }
+};
+
+struct CurveCache {
+    double step = 0;
+    double yScale = 0;
+    long k0 = 0;
+    std::vector<double> ys;
+    std::vector<std::vector<CurvePoint>> inner;
+    std::vector<char> pending;
+    std::vector<double> missX;
+    std::vector<long> missSlot;
+    Counter innerCount;
+};
+
+struct EdgeKey {
+    long i, j;
+    int dir;
+    
+    bool operator==(const EdgeKey& o) const { return i == o.i && j == o.j && dir == o.dir; }
+};
+
+struct EdgeKeyHash {
+    size_t operator()(const EdgeKey& k) const {
+        return std::hash<long>()(k.i * 73856093L ^ k.j * 19349663L ^ k.dir);
+    }
+};
+
+struct ContourSeg {
+    EdgeKey ea, eb;
+    CurvePoint a, b;
+};
+
+struct GridTile {
+    bool done = false;
+    std::vector<ContourSeg> segs;
+};
+
+struct GridCache {
+    static const int tile = 16;
+    double sx = 0, sy = 0;
+    std::map<std::pair<long, long>, GridTile> tiles;
+    std::vector<std::vector<CurvePoint>> lines;
+    bool dirty = true;
+};
+
+enum Level { Coarse, Fine };
+
+struct Equation {
+    std::string text;
+    Program prog;
+    std::set<std::string> uses;
+    mutable Counter evals;
+    mutable Counter sampleNs;
+    CurveCache curve[2];
+    GridCache grid[2];
+#ifdef MV_HAS_JIT
+    JitFunction jit;
+    bool jitFailed = false;
+#endif
+    
+    static const size_t jitThreshold = 100000;
+    
+    Equation(const std::string& t, Program p) : text(t), prog(std::move(p)) {}
+    
+    bool jitted() const {
+#ifdef MV_HAS_JIT
+        return jit.ready();
+#else
+        return false;
+#endif
+    }
+    
+    void tierUp() {
+#ifdef MV_HAS_JIT
+        if (!jit.ready() && !jitFailed && evals > jitThreshold) {
+            jitFailed = !jit.compile(prog);
+        }
+#endif
+    }
+    
+    Interval evalInterval(Interval x, Interval y) const {
+        evals += 1;
+        return prog.evalInterval(x, y);
+    }
+    
+    void evalBatch(const double* xs, const double* ys, double* out, size_t n) const {
+        evals += n;
+#ifdef MV_HAS_JIT
+        if (jit.ready()) {
+            jit.evalBatch(xs, ys, out, n);
+            return;
+        }
+#endif
+        prog.evalBatch(xs, ys, out, n);
+    }
+};
+
+class ThreadPool {
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+    
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex sleepLock;
+    std::condition_variable wake;
+    std::atomic<size_t> queued;
+    std::atomic<size_t> pending;
+    bool stopping;
+    
+    bool popLocal(size_t q, std::function<void()>& task) {
+        std::lock_guard<std::mutex> lk(queues[q]->lock);
+        if (queues[q]->tasks.empty()) return false;
+        task = std::move(queues[q]->tasks.back());
+        queues[q]->tasks.pop_back();
+        return true;
+    }
+    
+    bool steal(size_t self, std::function<void()>& task) {
+        for (size_t k = 1; k < queues.size(); k++) {
+            Queue& q = *queues[(self + k) % queues.size()];
+            std::lock_guard<std::mutex> lk(q.lock);
+            if (q.tasks.empty()) continue;
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+    
+    bool runOne(size_t self) {
+        std::function<void()> task;
+        if (!popLocal(self, task) && !steal(self, task)) return false;
+        queued--;
+        task();
+        pending--;
+        return true;
+    }
+    
+    void workerLoop(size_t self) {
+        while (true) {
+            if (runOne(self)) continue;
+            std::unique_lock<std::mutex> lk(sleepLock);
+            wake.wait(lk, [this] { return stopping || queued > 0; });
+            if (stopping) return;
+        }
+    }
+    
+public:
+    explicit ThreadPool(unsigned workers = std::max(1u, std::thread::hardware_concurrency()) - 1)
+        : queued(0), pending(0), stopping(false) {
+        for (unsigned i = 0; i <= workers; i++) {
+            queues.emplace_back(new Queue());
+        }
+        for (unsigned i = 1; i <= workers; i++) {
+            threads.emplace_back(&ThreadPool::workerLoop, this, i);
+        }
+    }
+    
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lk(sleepLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : threads) t.join();
+    }
+    
+    size_t size() const { return queues.size(); }
+    
+    // Runs every task and returns when all have finished; the caller works too.
+    void run(std::vector<std::function<void()>>& tasks) {
+        if (tasks.empty()) return;
+        if (threads.empty()) {
+            for (auto& t : tasks) t();
+            tasks.clear();
+            return;
+        }
+        
+        pending += tasks.size();
+        {
+            std::lock_guard<std::mutex> lk(sleepLock);
+            queued += tasks.size();
+        }
+        for (size_t i = 0; i < tasks.size(); i++) {
+            Queue& q = *queues[i % queues.size()];
+            std::lock_guard<std::mutex> lk(q.lock);
+            q.tasks.push_back(std::move(tasks[i]));
+        }
+        wake.notify_all();
+        tasks.clear();
+        
+        while (pending > 0) {
+            if (!runOne(0)) std::this_thread::yield();
+        }
+    }
+};
+
+struct Scratch {
+    std::vector<double> xs, ys, vals, corners;
+    std::vector<double*> outs;
+    std::vector<long> slots;
+    std::vector<CurveSpan> next;
+    std::vector<std::pair<long, long>> cells;
+    
+    static Scratch& get() {
+        static thread_local Scratch s;
+        return s;
+    }
+};
+
+struct View {
+    double xMin, xMax, yMin, yMax;
+    int w, h;
+    
+    bool operator==(const View& o) const {
+        return xMin == o.xMin && xMax == o.xMax && yMin == o.yMin && yMax == o.yMax && w == o.w && h == o.h;
+    }
+};
+
+struct Snapshot {
+    View view;
+    bool coarse;
+    std::vector<std::shared_ptr<Equation>> eqs;
+    std::vector<std::vector<std::vector<CurvePoint>>> lines;
+};
+
+// Samples on a background thread so the UI never waits. Each request bumps the
+// generation; jobs from older generations stop at the next task boundary.
+class Sampler {
+private:
+    struct Resolution {
+        int pxPerSample;
+        int maxDepth;
+        int budgetPerPx;
+        int cellPx;
+    };
+    
+    typedef std::vector<std::shared_ptr<Equation>> Group;
+    
+    ThreadPool pool;
+    std::vector<std::function<void()>> tasks;
+    std::map<Group, Program> fused[2];
+    
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stopping;
+    bool requested;
+    bool hasJob;
+    View jobView;
+    std::vector<std::shared_ptr<Equation>> jobEqs;
+    std::atomic<unsigned> generation;
+    std::shared_ptr<const Snapshot> done;
+    
+    View view;
+    unsigned gen;
+    std::thread worker;
+    
+    static const Resolution& resolution(int level) {
+        static const Resolution r[2] = {{16, 6, 1, 16}, {4, 10, 4, 4}};
+        return r[level];
+    }
+    
+    bool stale(unsigned g) const { return generation != g; }
+    
+    // A coarse pass is pointless when the picture for this view is already up.
+    bool showing(const std::vector<std::shared_ptr<Equation>>& eqs) {
+        std::lock_guard<std::mutex> lk(lock);
+        return done && done->view == view && done->eqs == eqs;
+    }
+    
+    void loop() {
+        while (true) {
+            std::vector<std::shared_ptr<Equation>> eqs;
+            {
+                std::unique_lock<std::mutex> lk(lock);
+                wake.wait(lk, [this] { return stopping || hasJob; });
+                if (stopping) return;
+                hasJob = false;
+                view = jobView;
+                eqs = jobEqs;
+                gen = generation;
+            }
+            
+            bool rescaled = false;
+            for (const auto& eq : eqs) rescaled = rescaled || needsRescale(*eq);
+            if (rescaled && !showing(eqs) && sample(eqs, Coarse)) publish(eqs, Coarse);
+            if (!stale(gen) && sample(eqs, Fine)) publish(eqs, Fine);
+        }
+    }
+    
+    bool needsRescale(const Equation& eq) const {
+        const Resolution& r = resolution(Fine);
+        if (eq.prog.usesY()) {
+            return !sameStep(eq.grid[Fine].sx, r.cellPx * (view.xMax - view.xMin) / view.w) ||
+                   !sameStep(eq.grid[Fine].sy, r.cellPx * (view.yMax - view.yMin) / view.h);
+        }
+        int pts = std::max(32, view.w / r.pxPerSample);
+        return !sameStep(eq.curve[Fine].step, (view.xMax - view.xMin) / pts) ||
+               !sameStep(eq.curve[Fine].yScale, view.h / (view.yMax - view.yMin));
+    }
+    
+    bool sample(const std::vector<std::shared_ptr<Equation>>& eqs, int level) {
+        ProfileScope prof(level == Coarse ? "sampleCoarse" : "sampleFine");
+        for (const auto& eq : eqs) {
+            eq->tierUp();
+            if (eq->prog.usesY()) {
+                planGrid(*eq, level);
+            } else {
+                planCurve(*eq, level);
+            }
+        }
+        planBase(eqs, level);
+        pool.run(tasks);
+        if (stale(gen)) return false;
+        
+        for (const auto& eq : eqs) {
+            if (eq->prog.usesY()) {
+                planChain(*eq, level);
+            } else {
+                planRefine(*eq, level);
+            }
+        }
+        pool.run(tasks);
+        return !stale(gen);
+    }
+    
+    std::shared_ptr<const Snapshot> publish(const std::vector<std::shared_ptr<Equation>>& eqs, int level) {
+        std::shared_ptr<Snapshot> s = std::make_shared<Snapshot>();
+        s->view = view;
+        s->coarse = level == Coarse;
+        s->eqs = eqs;
+        for (const auto& eq : eqs) {
+            s->lines.emplace_back();
+            std::vector<std::vector<CurvePoint>>& lines = s->lines.back();
+            if (eq->prog.usesY()) {
+                lines = eq->grid[level].lines;
+                continue;
+            }
+            
+            const CurveCache& c = eq->curve[level];
+            std::vector<CurvePoint> line;
+            auto emit = [&](double x, double y) {
+                if (std::isfinite(y)) {
+                    line.push_back({x, y});
+                    return;
+                }
+                if (line.size() > 1) lines.push_back(line);
+                line.clear();
+            };
+            for (size_t i = 0; i < c.ys.size(); i++) {
+                emit((c.k0 + static_cast<long>(i)) * c.step, c.ys[i]);
+                for (const CurvePoint& p : c.inner[i]) {
+                    emit(p.x, p.y);
+                }
+            }
+            if (line.size() > 1) lines.push_back(line);
+        }
+        
+        std::lock_guard<std::mutex> lk(lock);
+        done = s;
+        return s;
+    }
+    
+    static bool sameStep(double a, double b) {
+        return fabs(a - b) <= 1e-9 * fabs(b);
+    }
+    
+    void planCurve(Equation& eq, int level) {
+        CurveCache& c = eq.curve[level];
+        c.missX.clear();
+        c.missSlot.clear();
+        
+        int pts = std::max(32, view.w / resolution(level).pxPerSample);
+        double step = (view.xMax - view.xMin) / pts;
+        if (!sameStep(c.step, step)) {
+            c.step = step;
+            c.ys.clear();
+            c.inner.clear();
+            c.pending.clear();
+        }
+        
+        long k0 = static_cast<long>(floor(view.xMin / c.step));
+        long k1 = k0 + pts + 1;
+        long oldK0 = c.k0;
+        long oldK1 = c.k0 + static_cast<long>(c.ys.size());
+        if (k0 == oldK0 && k1 + 1 == oldK1) return;
+        
+        size_t n = k1 - k0 + 1;
+        std::vector<double> ys(n);
+        std::vector<std::vector<CurvePoint>> inner(n);
+        std::vector<char> pending(n, 1);
+        size_t innerCount = 0;
+        
+        for (long k = k0; k <= k1; k++) {
+            if (k >= oldK0 && k < oldK1) {
+                ys[k - k0] = c.ys[k - oldK0];
+                if (k + 1 < oldK1) {
+                    inner[k - k0].swap(c.inner[k - oldK0]);
+                    pending[k - k0] = c.pending[k - oldK0];
+                    innerCount += inner[k - k0].size();
+                }
+            } else {
+                c.missX.push_back(k * c.step);
+                c.missSlot.push_back(k - k0);
+            }
+        }
+        
+        c.ys.swap(ys);
+        c.inner.swap(inner);
+        c.pending.swap(pending);
+        c.innerCount = innerCount;
+        c.k0 = k0;
+    }
+    
+    // Curves missing the same x positions share one fused pass over them, so
+    // subexpressions common to several equations are computed once per sample.
+    void planBase(const std::vector<std::shared_ptr<Equation>>& eqs, int level) {
+        std::vector<Group> groups;
+        for (const auto& eq : eqs) {
+            const std::vector<double>& xs = eq->curve[level].missX;
+            if (eq->prog.usesY() || xs.empty()) continue;
+            auto it = std::find_if(groups.begin(), groups.end(),
+                                   [&](const Group& g) { return g[0]->curve[level].missX == xs; });
+            if (it == groups.end()) {
+                groups.push_back({eq});
+            } else {
+                it->push_back(eq);
+            }
+        }
+        
+        std::map<Group, Program> keep;
+        for (const Group& g : groups) {
+            if (g.size() == 1) {
+                planSample(*g[0], level);
+                continue;
+            }
+            
+            Program& prog = keep[g];
+            auto old = fused[level].find(g);
+            if (old != fused[level].end()) {
+                prog = std::move(old->second);
+            } else {
+                std::vector<const Program*> progs;
+                for (const auto& eq : g) progs.push_back(&eq->prog);
+                prog = Optimizer().fuse(progs);
+            }
+            if (prog.outputCount() != static_cast<int>(g.size())) {
+                for (const auto& eq : g) planSample(*eq, level);
+                continue;
+            }
+            
+            const std::vector<double>& xs = g[0]->curve[level].missX;
+            const size_t chunk = 512;
+            for (size_t start = 0; start < xs.size(); start += chunk) {
+                size_t cnt = std::min(chunk, xs.size() - start);
+                tasks.push_back([g, &prog, &xs, start, cnt, level] {
+                    ProfileScope prof("sampleFused");
+                    Scratch& s = Scratch::get();
+                    s.vals.resize(cnt * g.size());
+                    s.outs.resize(g.size());
+                    for (size_t e = 0; e < g.size(); e++) s.outs[e] = &s.vals[e * cnt];
+                    prog.evalBatch(&xs[start], nullptr, s.outs.data(), static_cast<int>(g.size()), cnt);
+                    for (size_t e = 0; e < g.size(); e++) {
+                        CurveCache& c = g[e]->curve[level];
+                        g[e]->evals += cnt;
+                        for (size_t i = 0; i < cnt; i++) {
+                            c.ys[c.missSlot[start + i]] = s.outs[e][i];
+                        }
+                    }
+                });
+            }
+        }
+        fused[level].swap(keep);
+    }
+    
+    void planSample(Equation& eq, int level) {
+        CurveCache& c = eq.curve[level];
+        const size_t chunk = 512;
+        for (size_t start = 0; start < c.missX.size(); start += chunk) {
+            size_t cnt = std::min(chunk, c.missX.size() - start);
+            tasks.push_back([&eq, &c, start, cnt] {
+                ProfileScope prof("sampleCurve", &eq.text, &eq.sampleNs);
+                std::vector<double>& vals = Scratch::get().vals;
+                vals.resize(cnt);
+                eq.evalBatch(&c.missX[start], nullptr, vals.data(), cnt);
+                for (size_t i = 0; i < cnt; i++) {
+                    c.ys[c.missSlot[start + i]] = vals[i];
+                }
+            });
+        }
+    }
+    
+    void planRefine(Equation& eq, int level) {
+        CurveCache& c = eq.curve[level];
+        const Resolution& r = resolution(level);
+        
+        double yScale = view.h / (view.yMax - view.yMin);
+        if (!sameStep(c.yScale, yScale)) {
+            c.yScale = yScale;
+            for (auto& in : c.inner) in.clear();
+            std::fill(c.pending.begin(), c.pending.end(), 1);
+            c.innerCount = 0;
+        }
+        
+        double margin = view.yMax - view.yMin;
+        double lo = view.yMin - margin, hi = view.yMax + margin;
+        auto side = [lo, hi](double v) { return v > hi ? 1 : v < lo ? -1 : 0; };
+        
+        std::vector<CurveSpan> spans;
+        for (size_t i = 0; i + 1 < c.ys.size(); i++) {
+            if (!c.pending[i]) continue;
+            double fa = c.ys[i], fb = c.ys[i + 1];
+            if (side(fa) != 0 && side(fa) == side(fb)) continue;
+            
+            double a = (c.k0 + static_cast<long>(i)) * c.step;
+            spans.push_back({a, fa, a + c.step, fb, 0, i});
+            c.pending[i] = 0;
+        }
+        
+        const size_t chunk = 32;
+        size_t budget = static_cast<size_t>(r.budgetPerPx) * view.w;
+        int maxDepth = r.maxDepth;
+        unsigned g = gen;
+        for (size_t start = 0; start < spans.size(); start += chunk) {
+            size_t end = std::min(spans.size(), start + chunk);
+            std::vector<CurveSpan> part(spans.begin() + start, spans.begin() + end);
+            tasks.push_back([this, &eq, &c, part, lo, hi, budget, maxDepth, g]() mutable {
+                if (stale(g)) {
+                    for (const CurveSpan& sp : part) c.pending[sp.owner] = 1;
+                    return;
+                }
+                ProfileScope prof("refineCurve", &eq.text, &eq.sampleNs);
+                refineSpans(eq, c, part, lo, hi, budget, maxDepth);
+            });
+        }
+    }
+    
+    static void refineSpans(const Equation& eq, CurveCache& c, std::vector<CurveSpan>& spans,
+                            double lo, double hi, size_t budget, int maxDepth) {
+        Scratch& s = Scratch::get();
+        
+        const double tol = 0.4;
+        const double jumpPx = 20;
+        auto side = [lo, hi](double v) { return v > hi ? 1 : v < lo ? -1 : 0; };
+        
+        std::vector<size_t> owners;
+        for (const CurveSpan& sp : spans) owners.push_back(sp.owner);
+        
+        while (!spans.empty()) {
+            s.xs.resize(spans.size());
+            s.vals.resize(spans.size());
+            for (size_t i = 0; i < spans.size(); i++) {
+                s.xs[i] = (spans[i].a + spans[i].b) / 2;
+            }
+            eq.evalBatch(s.xs.data(), nullptr, s.vals.data(), spans.size());
+            c.innerCount += spans.size();
+            
+            s.next.clear();
+            for (size_t i = 0; i < spans.size(); i++) {
+                const CurveSpan& sp = spans[i];
+                double m = s.xs[i], fm = s.vals[i];
+                std::vector<CurvePoint>& out = c.inner[sp.owner];
+                out.push_back({m, fm});
+                
+                bool split;
+                bool finite = std::isfinite(sp.fa) && std::isfinite(sp.fb) && std::isfinite(fm);
+                if (finite) {
+                    int sa = side(sp.fa), sm = side(fm), sb = side(sp.fb);
+                    double dev = fabs(fm - (sp.fa + sp.fb) / 2) * c.yScale;
+                    split = dev > tol && !(sa != 0 && sa == sm && sm == sb);
+                    
+                    if (split && sp.depth + 1 >= maxDepth) {
+                        double dl = fm - sp.fa, dr = sp.fb - fm;
+                        if (dl * dr < 0 && std::min(fabs(dl), fabs(dr)) * c.yScale > jumpPx) {
+                            out.back().y = NAN;
+                        } else if (fabs(dl + dr) * c.yScale > jumpPx &&
+                                   std::max(fabs(dl), fabs(dr)) > 0.9 * fabs(dl + dr)) {
+                            double bx = fabs(dl) > fabs(dr) ? (sp.a + m) / 2 : (m + sp.b) / 2;
+                            out.push_back({bx, NAN});
+                        }
+                    }
+                } else {
+                    split = std::isfinite(sp.fa) || std::isfinite(sp.fb) || std::isfinite(fm);
+                }
+                
+                if (split && sp.depth + 1 < maxDepth && c.innerCount < budget) {
+                    s.next.push_back({sp.a, sp.fa, m, fm, sp.depth + 1, sp.owner});
+                    s.next.push_back({m, fm, sp.b, sp.fb, sp.depth + 1, sp.owner});
+                }
+            }
+            spans.swap(s.next);
+        }
+        
+        for (size_t o : owners) {
+            std::vector<CurvePoint>& in = c.inner[o];
+            std::sort(in.begin(), in.end(), [](const CurvePoint& p, const CurvePoint& q) { return p.x < q.x; });
+        }
+    }
+    
+    static void subdivide(const Equation& eq, const GridCache& g, std::vector<std::pair<long, long>>& cells,
+                          long i0, long j0, int size) {
+        Interval x(i0 * g.sx, (i0 + size) * g.sx);
+        Interval y(j0 * g.sy, (j0 + size) * g.sy);
+        if (!eq.evalInterval(x, y).contains(0)) return;
+        
+        if (size == 1) {
+            cells.push_back({i0, j0});
+            return;
+        }
+        
+        int half = size / 2;
+        subdivide(eq, g, cells, i0, j0, half);
+        subdivide(eq, g, cells, i0 + half, j0, half);
+        subdivide(eq, g, cells, i0, j0 + half, half);
+        subdivide(eq, g, cells, i0 + half, j0 + half, half);
+    }
+    
+    static void contourTile(const Equation& eq, const GridCache& g, GridTile& t, long ti, long tj) {
+        const int T = GridCache::tile;
+        const int N = T + 1;
+        long bi = ti * T, bj = tj * T;
+        
+        Scratch& s = Scratch::get();
+        std::vector<double>& xs = s.xs;
+        std::vector<double>& ys = s.ys;
+        std::vector<double>& vals = s.vals;
+        std::vector<double>& corners = s.corners;
+        std::vector<long>& slots = s.slots;
+        std::vector<std::pair<long, long>>& cells = s.cells;
+        
+        cells.clear();
+        subdivide(eq, g, cells, bi, bj, T);
+        if (cells.empty()) return;
+        
+        corners.assign(N * N, NAN);
+        std::vector<char> need(N * N, 0);
+        for (const auto& c : cells) {
+            long li = c.first - bi, lj = c.second - bj;
+            need[li * N + lj] = need[(li + 1) * N + lj] = need[li * N + lj + 1] = need[(li + 1) * N + lj + 1] = 1;
+        }
+        xs.clear();
+        ys.clear();
+        slots.clear();
+        for (int k = 0; k < N * N; k++) {
+            if (!need[k]) continue;
+            xs.push_back((bi + k / N) * g.sx);
+            ys.push_back((bj + k % N) * g.sy);
+            slots.push_back(k);
+        }
+        vals.resize(xs.size());
+        eq.evalBatch(xs.data(), ys.data(), vals.data(), xs.size());
+        for (size_t k = 0; k < slots.size(); k++) corners[slots[k]] = vals[k];
+        
+        // Corners c0..c3 run counter-clockwise from (i, j); edge e_k joins c_k and c_(k+1).
+        static const int cornerDi[4] = {0, 1, 1, 0};
+        static const int cornerDj[4] = {0, 0, 1, 1};
+        
+        struct Crossing {
+            EdgeKey key;
+            double x0, y0, x1, y1, f0, f1, t;
+        };
+        std::vector<Crossing> crossings;
+        std::unordered_map<EdgeKey, size_t, EdgeKeyHash> crossingOf;
+        
+        struct CellCase {
+            long i, j;
+            int edges[4];
+            int mask;
+            double center;
+        };
+        std::vector<CellCase> cases;
+        
+        for (const auto& c : cells) {
+            long li = c.first - bi, lj = c.second - bj;
+            double f[4];
+            int mask = 0;
+            bool ok = true;
+            for (int k = 0; k < 4; k++) {
+                f[k] = corners[(li + cornerDi[k]) * N + lj + cornerDj[k]];
+                if (!std::isfinite(f[k])) ok = false;
+                if (f[k] > 0) mask |= 1 << k;
+            }
+            if (!ok || mask == 0 || mask == 15) continue;
+            
+            CellCase cc = {c.first, c.second, {-1, -1, -1, -1}, mask, 0};
+            for (int k = 0; k < 4; k++) {
+                int n = (k + 1) % 4;
+                if (((mask >> k) & 1) == ((mask >> n) & 1)) continue;
+                
+                long ai = c.first + cornerDi[k], aj = c.second + cornerDj[k];
+                long ci = c.first + cornerDi[n], cj = c.second + cornerDj[n];
+                double fa = f[k], fc = f[n];
+                if (ai > ci || aj > cj) {
+                    std::swap(ai, ci);
+                    std::swap(aj, cj);
+                    std::swap(fa, fc);
+                }
+                EdgeKey key = {ai, aj, ai == ci ? 1 : 0};
+                
+                auto it = crossingOf.find(key);
+                if (it == crossingOf.end()) {
+                    it = crossingOf.emplace(key, crossings.size()).first;
+                    crossings.push_back({key, ai * g.sx, aj * g.sy, ci * g.sx, cj * g.sy, fa, fc, fa / (fa - fc)});
+                }
+                cc.edges[k] = static_cast<int>(it->second);
+            }
+            cases.push_back(cc);
+        }
+        
+        xs.clear();
+        ys.clear();
+        for (const CellCase& cc : cases) {
+            if (cc.mask == 5 || cc.mask == 10) {
+                xs.push_back((cc.i + 0.5) * g.sx);
+                ys.push_back((cc.j + 0.5) * g.sy);
+            }
+        }
+        if (!xs.empty()) {
+            vals.resize(xs.size());
+            eq.evalBatch(xs.data(), ys.data(), vals.data(), xs.size());
+            size_t k = 0;
+            for (CellCase& cc : cases) {
+                if (cc.mask == 5 || cc.mask == 10) cc.center = vals[k++];
+            }
+        }
+        
+        // Illinois-style regula falsi along each crossed edge, batched per iteration.
+        std::vector<double> lo(crossings.size(), 0), hi(crossings.size(), 1);
+        std::vector<double> flo(crossings.size()), fhi(crossings.size()), fbest(crossings.size());
+        for (size_t k = 0; k < crossings.size(); k++) {
+            flo[k] = crossings[k].f0;
+            fhi[k] = crossings[k].f1;
+        }
+        for (int iter = 0; iter < 3 && !crossings.empty(); iter++) {
+            xs.resize(crossings.size());
+            ys.resize(crossings.size());
+            vals.resize(crossings.size());
+            for (size_t k = 0; k < crossings.size(); k++) {
+                const Crossing& c = crossings[k];
+                xs[k] = c.x0 + (c.x1 - c.x0) * c.t;
+                ys[k] = c.y0 + (c.y1 - c.y0) * c.t;
+            }
+            eq.evalBatch(xs.data(), ys.data(), vals.data(), xs.size());
+            
+            for (size_t k = 0; k < crossings.size(); k++) {
+                Crossing& c = crossings[k];
+                double fv = vals[k];
+                fbest[k] = fv;
+                if (!std::isfinite(fv) || fv == 0) continue;
+                if ((fv > 0) == (flo[k] > 0)) {
+                    lo[k] = c.t;
+                    flo[k] = fv;
+                    fhi[k] /= 2;
+                } else {
+                    hi[k] = c.t;
+                    fhi[k] = fv;
+                    flo[k] /= 2;
+                }
+                double nt = lo[k] + (hi[k] - lo[k]) * flo[k] / (flo[k] - fhi[k]);
+                c.t = std::isfinite(nt) ? nt : (lo[k] + hi[k]) / 2;
+            }
+        }
+        
+        std::vector<char> valid(crossings.size());
+        for (size_t k = 0; k < crossings.size(); k++) {
+            const Crossing& c = crossings[k];
+            double limit = 0.5 * std::min(fabs(c.f0), fabs(c.f1));
+            valid[k] = std::isfinite(fbest[k]) && (fabs(fbest[k]) <= limit || fabs(fbest[k]) < 1e-9);
+        }
+        
+        auto addSeg = [&](int e0, int e1) {
+            if (e0 < 0 || e1 < 0 || !valid[e0] || !valid[e1]) return;
+            const Crossing& a = crossings[e0];
+            const Crossing& b = crossings[e1];
+            t.segs.push_back({a.key, b.key,
+                              {a.x0 + (a.x1 - a.x0) * a.t, a.y0 + (a.y1 - a.y0) * a.t},
+                              {b.x0 + (b.x1 - b.x0) * b.t, b.y0 + (b.y1 - b.y0) * b.t}});
+        };
+        
+        for (const CellCase& cc : cases) {
+            const int* e = cc.edges;
+            if (cc.mask == 5 || cc.mask == 10) {
+                bool c0Positive = cc.mask == 5;
+                if ((cc.center > 0) == c0Positive) {
+                    addSeg(e[0], e[1]);
+                    addSeg(e[2], e[3]);
+                } else {
+                    addSeg(e[3], e[0]);
+                    addSeg(e[1], e[2]);
+                }
+                continue;
+            }
+            int first = -1;
+            for (int k = 0; k < 4; k++) {
+                if (e[k] < 0) continue;
+                if (first < 0) {
+                    first = e[k];
+                } else {
+                    addSeg(first, e[k]);
+                }
+            }
+        }
+    }
+    
+    static void chainSegments(GridCache& g) {
+        std::vector<std::vector<CurvePoint>>& lines = g.lines;
+        std::vector<const ContourSeg*> segs;
+        for (const auto& entry : g.tiles) {
+            for (const ContourSeg& s : entry.second.segs) segs.push_back(&s);
+        }
+        
+        std::unordered_map<EdgeKey, std::vector<size_t>, EdgeKeyHash> byEdge;
+        for (size_t k = 0; k < segs.size(); k++) {
+            byEdge[segs[k]->ea].push_back(k);
+            byEdge[segs[k]->eb].push_back(k);
+        }
+        
+        std::vector<char> used(segs.size(), 0);
+        auto extend = [&](std::vector<CurvePoint>& line, EdgeKey end) {
+            while (true) {
+                size_t nextSeg = segs.size();
+                for (size_t k : byEdge[end]) {
+                    if (!used[k]) {
+                        nextSeg = k;
+                        break;
+                    }
+                }
+                if (nextSeg == segs.size()) return;
+                used[nextSeg] = 1;
+                const ContourSeg* s = segs[nextSeg];
+                bool forward = s->ea == end;
+                line.push_back(forward ? s->b : s->a);
+                end = forward ? s->eb : s->ea;
+            }
+        };
+        
+        lines.clear();
+        for (size_t k = 0; k < segs.size(); k++) {
+            if (used[k]) continue;
+            used[k] = 1;
+            std::vector<CurvePoint> back = {segs[k]->a};
+            extend(back, segs[k]->ea);
+            std::vector<CurvePoint> line(back.rbegin(), back.rend());
+            line.push_back(segs[k]->b);
+            extend(line, segs[k]->eb);
+            lines.push_back(std::move(line));
+        }
+    }
+    
+    void planGrid(Equation& eq, int level) {
+        GridCache& g = eq.grid[level];
+        const int T = GridCache::tile;
+        
+        int cellPx = resolution(level).cellPx;
+        double sx = cellPx * (view.xMax - view.xMin) / view.w;
+        double sy = cellPx * (view.yMax - view.yMin) / view.h;
+        if (!sameStep(g.sx, sx) || !sameStep(g.sy, sy)) {
+            g.sx = sx;
+            g.sy = sy;
+            g.tiles.clear();
+            g.dirty = true;
+        }
+        
+        auto tileOf = [T](double v, double s) { return static_cast<long>(floor(v / (s * T))); };
+        long t0x = tileOf(view.xMin, g.sx), t1x = tileOf(view.xMax, g.sx);
+        long t0y = tileOf(view.yMin, g.sy), t1y = tileOf(view.yMax, g.sy);
+        
+        for (auto it = g.tiles.begin(); it != g.tiles.end();) {
+            long tx = it->first.first, ty = it->first.second;
+            if (tx < t0x || tx > t1x || ty < t0y || ty > t1y) {
+                it = g.tiles.erase(it);
+                g.dirty = true;
+            } else {
+                ++it;
+            }
+        }
+        
+        unsigned gn = gen;
+        for (long tx = t0x; tx <= t1x; tx++) {
+            for (long ty = t0y; ty <= t1y; ty++) {
+                GridTile& t = g.tiles[std::make_pair(tx, ty)];
+                if (t.done) continue;
+                g.dirty = true;
+                tasks.push_back([this, &eq, &g, &t, tx, ty, gn] {
+                    if (stale(gn)) return;
+                    ProfileScope prof("contourTile", &eq.text, &eq.sampleNs);
+                    contourTile(eq, g, t, tx, ty);
+                    t.done = true;
+                });
+            }
+        }
+    }
+    
+    void planChain(Equation& eq, int level) {
+        GridCache& g = eq.grid[level];
+        if (!g.dirty) return;
+        g.dirty = false;
+        unsigned gn = gen;
+        tasks.push_back([this, &eq, &g, gn] {
+            if (stale(gn)) {
+                g.dirty = true;
+                return;
+            }
+            ProfileScope prof("chainSegments", &eq.text, &eq.sampleNs);
+            chainSegments(g);
+        });
+    }
+    
+public:
+    explicit Sampler(bool background = true)
+        : stopping(false), requested(false), hasJob(false), generation(0), gen(0) {
+        if (background) worker = std::thread(&Sampler::loop, this);
+    }
+    
+    ~Sampler() {
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            stopping = true;
+            generation++;
+        }
+        wake.notify_all();
+        if (worker.joinable()) worker.join();
+    }
+    
+    void request(const View& v, const std::vector<std::shared_ptr<Equation>>& eqs) {
+        std::lock_guard<std::mutex> lk(lock);
+        if (requested && v == jobView && eqs == jobEqs) return;
+        requested = true;
+        hasJob = true;
+        jobView = v;
+        jobEqs = eqs;
+        generation++;
+        wake.notify_one();
+    }
+    
+    // Full-resolution pass on the calling thread, for samplers built without a worker.
+    std::shared_ptr<const Snapshot> sampleNow(const View& v, const std::vector<std::shared_ptr<Equation>>& eqs) {
+        view = v;
+        gen = generation;
+        sample(eqs, Fine);
+        return publish(eqs, Fine);
+    }
+    
+    std::shared_ptr<const Snapshot> latest() {
+        std::lock_guard<std::mutex> lk(lock);
+        return done;
+    }
+    
+    // Stands in for the first pass, e.g. geometry restored from a session cache.
+    void seed(std::shared_ptr<const Snapshot> snap) {
+        std::lock_guard<std::mutex> lk(lock);
+        if (!done) done = std::move(snap);
+    }
+};
+
+struct Feature {
+    enum Kind { Root, Extremum, Intersection };
+    
+    Kind kind;
+    double x, y;
+    std::shared_ptr<Equation> a, b;
+};
+
+struct Analysis {
+    std::shared_ptr<const Snapshot> snap;
+    std::vector<Feature> features;
+};
+
+// Finds zeros, local extrema and pairwise intersections of the explicit curves in
+// a snapshot. Brackets come from the sampled polylines; each is refined with
+// Brent's method on the compiled program. Results are kept per equation and per
+// pair, so after a pan at the same scale only the newly exposed x range is
+// searched. Runs on its own worker and pool.
+class Analyzer {
+private:
+    typedef std::pair<std::shared_ptr<Equation>, std::shared_ptr<Equation>> Key;
+    
+    struct Found {
+        double scale = 0;
+        double lo = 0, hi = 0;
+        std::vector<Feature> features;
+    };
+    
+    ThreadPool pool;
+    std::vector<std::function<void()>> tasks;
+    std::map<Key, Found> found;
+    
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stopping;
+    std::shared_ptr<const Snapshot> job;
+    std::shared_ptr<const Analysis> done;
+    std::atomic<unsigned> finished;
+    std::thread worker;
+    
+    static double evalAt(const Equation& e, double x) {
+        e.evals += 1;
+        return e.prog.eval(x);
+    }
+    
+    template <typename F>
+    static bool brentRoot(F f, double a, double b, double fa, double fb, double& root) {
+        if (fa * fb > 0) return false;
+        double c = a, fc = fa, d = b - a, e = d;
+        for (int it = 0; it < 100; it++) {
+            if (fb * fc > 0) {
+                c = a;
+                fc = fa;
+                d = e = b - a;
+            }
+            if (fabs(fc) < fabs(fb)) {
+                a = b; b = c; c = a;
+                fa = fb; fb = fc; fc = fa;
+            }
+            double tol = 2e-16 * fabs(b) + 1e-300;
+            double m = (c - b) / 2;
+            if (fabs(m) <= tol || fb == 0) break;
+            if (fabs(e) >= tol && fabs(fa) > fabs(fb)) {
+                double s = fb / fa, p, q;
+                if (a == c) {
+                    p = 2 * m * s;
+                    q = 1 - s;
+                } else {
+                    double r = fb / fc, t = fa / fc;
+                    p = s * (2 * m * t * (t - r) - (b - a) * (r - 1));
+                    q = (t - 1) * (r - 1) * (s - 1);
+                }
+                if (p > 0) q = -q; else p = -p;
+                if (2 * p < std::min(3 * m * q - fabs(tol * q), fabs(e * q))) {
+                    e = d;
+                    d = p / q;
+                } else {
+                    d = m;
+                    e = m;
+                }
+            } else {
+                d = m;
+                e = m;
+            }
+            a = b;
+            fa = fb;
+            b += fabs(d) > tol ? d : (m > 0 ? tol : -tol);
+            fb = f(b);
+        }
+        root = b;
+        return std::isfinite(fb);
+    }
+    
+    // Brent's parabolic/golden-section minimisation of f on [a, b].
+    template <typename F>
+    static double brentMin(F f, double a, double b) {
+        const double golden = 0.3819660112501051;
+        double x = a + golden * (b - a), w = x, v = x;
+        double fx = f(x), fw = fx, fv = fx;
+        double d = 0, e = 0;
+        for (int it = 0; it < 100; it++) {
+            double m = (a + b) / 2;
+            double tol = 1e-10 * fabs(x) + 1e-300;
+            if (fabs(x - m) <= 2 * tol - (b - a) / 2) break;
+            bool golden_step = true;
+            if (fabs(e) > tol) {
+                double r = (x - w) * (fx - fv), q = (x - v) * (fx - fw);
+                double p = (x - v) * q - (x - w) * r;
+                q = 2 * (q - r);
+                if (q > 0) p = -p; else q = -q;
+                if (fabs(p) < fabs(q * e / 2) && p > q * (a - x) && p < q * (b - x)) {
+                    e = d;
+                    d = p / q;
+                    golden_step = false;
+                }
+            }
+            if (golden_step) {
+                e = x < m ? b - x : a - x;
+                d = golden * e;
+            }
+            double u = x + (fabs(d) >= tol ? d : (d > 0 ? tol : -tol));
+            double fu = f(u);
+            if (fu <= fx) {
+                if (u < x) b = x; else a = x;
+                v = w; fv = fw;
+                w = x; fw = fx;
+                x = u; fx = fu;
+            } else {
+                if (u < x) a = u; else b = u;
+                if (fu <= fw || w == x) {
+                    v = w; fv = fw;
+                    w = u; fw = fu;
+                } else if (fu <= fv || v == x || v == w) {
+                    v = u; fv = fu;
+                }
+            }
+        }
+        return x;
+    }
+    
+    // A sign change across a pole is not a zero: the refined point must be small
+    // compared with the bracket's ends.
+    static bool genuine(double fr, double fa, double fb) {
+        return std::isfinite(fr) && fabs(fr) <= 1e-6 * std::max(1.0, std::max(fabs(fa), fabs(fb)));
+    }
+    
+    static void searchCurve(const Key& k, const std::vector<std::vector<CurvePoint>>& lines,
+                            double lo, double hi, std::vector<Feature>& out) {
+        const Equation& e = *k.first;
+        auto f = [&e](double x) { return evalAt(e, x); };
+        for (const auto& line : lines) {
+            for (size_t i = 0; i + 1 < line.size(); i++) {
+                const CurvePoint& p = line[i];
+                const CurvePoint& q = line[i + 1];
+                if (p.x < lo || p.x >= hi) continue;
+                
+                double r;
+                if (p.y == 0 && (i == 0 || line[i - 1].y != 0)) {
+                    out.push_back({Feature::Root, p.x, 0, k.first, nullptr});
+                } else if (p.y * q.y < 0 && brentRoot(f, p.x, q.x, p.y, q.y, r) && genuine(f(r), p.y, q.y)) {
+                    out.push_back({Feature::Root, r, 0, k.first, nullptr});
+                }
+                
+                if (i == 0) continue;
+                const CurvePoint& o = line[i - 1];
+                double d1 = p.y - o.y, d2 = q.y - p.y;
+                if (d1 * d2 >= 0) continue;
+                double sign = d1 > 0 ? -1 : 1;
+                double x = brentMin([&](double t) { return sign * f(t); }, o.x, q.x);
+                double y = f(x);
+                if (std::isfinite(y) && x > o.x && x < q.x) out.push_back({Feature::Extremum, x, y, k.first, nullptr});
+            }
+        }
+    }
+    
+    static void searchPair(const Key& k, const std::vector<std::vector<CurvePoint>>& lines,
+                           double lo, double hi, std::vector<Feature>& out) {
+        const Equation& a = *k.first;
+        const Equation& b = *k.second;
+        auto h = [&](double x) { return evalAt(a, x) - evalAt(b, x); };
+        for (const auto& line : lines) {
+            double prev = NAN;
+            for (size_t i = 0; i + 1 < line.size(); i++) {
+                const CurvePoint& p = line[i];
+                const CurvePoint& q = line[i + 1];
+                if (q.x < lo || p.x >= hi) {
+                    prev = NAN;
+                    continue;
+                }
+                double hp = std::isnan(prev) ? p.y - evalAt(b, p.x) : prev;
+                double hq = q.y - evalAt(b, q.x);
+                prev = hq;
+                if (p.x < lo) continue;
+                
+                double r;
+                if (hp == 0 && hq != 0) {
+                    out.push_back({Feature::Intersection, p.x, p.y, k.first, k.second});
+                } else if (hp * hq < 0 && brentRoot(h, p.x, q.x, hp, hq, r) && genuine(h(r), hp, hq)) {
+                    out.push_back({Feature::Intersection, r, evalAt(a, r), k.first, k.second});
+                }
+            }
+        }
+    }
+    
+    // Keeps what is known inside [lo, hi] at this scale and searches only the rest.
+    static void update(const Key& k, Found& f, const std::vector<std::vector<CurvePoint>>& lines,
+                       double scale, double lo, double hi) {
+        auto search = [&](double a, double b) {
+            if (b <= a) return;
+            if (k.second) {
+                searchPair(k, lines, a, b, f.features);
+            } else {
+                searchCurve(k, lines, a, b, f.features);
+            }
+        };
+        
+        if (f.scale == 0 || fabs(f.scale - scale) > 1e-9 * scale || f.hi <= lo || f.lo >= hi) {
+            f.features.clear();
+            search(lo, hi);
+        } else {
+            f.features.erase(std::remove_if(f.features.begin(), f.features.end(),
+                                            [lo, hi](const Feature& x) { return x.x < lo || x.x >= hi; }),
+                             f.features.end());
+            search(lo, f.lo);
+            search(f.hi, hi);
+        }
+        f.scale = scale;
+        f.lo = lo;
+        f.hi = hi;
+    }
+    
+    void run(const std::shared_ptr<const Snapshot>& snap) {
+        ProfileScope prof("analyze");
+        const View& v = snap->view;
+        double scale = (v.xMax - v.xMin) / v.w;
+        
+        std::vector<size_t> curves;
+        for (size_t i = 0; i < snap->eqs.size(); i++) {
+            if (!snap->eqs[i]->prog.usesY()) curves.push_back(i);
+        }
+        
+        std::map<Key, Found> next;
+        for (size_t m = 0; m < curves.size(); m++) {
+            for (size_t n = m; n < curves.size(); n++) {
+                const std::shared_ptr<Equation>& a = snap->eqs[curves[m]];
+                Key k(a, n == m ? nullptr : snap->eqs[curves[n]]);
+                if (k.second == k.first) continue;
+                auto old = found.find(k);
+                if (old != found.end()) next[k] = std::move(old->second);
+                Found& f = next[k];
+                const std::vector<std::vector<CurvePoint>>& lines = snap->lines[curves[m]];
+                tasks.push_back([k, &f, &lines, scale, v] { update(k, f, lines, scale, v.xMin, v.xMax); });
+            }
+        }
+        pool.run(tasks);
+        found.swap(next);
+        
+        std::shared_ptr<Analysis> a = std::make_shared<Analysis>();
+        a->snap = snap;
+        for (const auto& f : found) {
+            a->features.insert(a->features.end(), f.second.features.begin(), f.second.features.end());
+        }
+        
+        std::lock_guard<std::mutex> lk(lock);
+        done = a;
+        finished++;
+    }
+    
+    void loop() {
+        while (true) {
+            std::shared_ptr<const Snapshot> snap;
+            {
+                std::unique_lock<std::mutex> lk(lock);
+                wake.wait(lk, [this] { return stopping || job; });
+                if (stopping) return;
+                snap = job;
+            }
+            run(snap);
+            
+            std::lock_guard<std::mutex> lk(lock);
+            if (job == snap) job = nullptr;
+        }
+    }
+    
+public:
+    Analyzer() : stopping(false), finished(0) {
+        worker = std::thread(&Analyzer::loop, this);
+    }
+    
+    ~Analyzer() {
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        worker.join();
+    }
+    
+    // Only the newest snapshot is analysed; ones that arrive while busy replace each other.
+    void request(const std::shared_ptr<const Snapshot>& snap) {
+        std::lock_guard<std::mutex> lk(lock);
+        if (!snap || (done && done->snap == snap) || job == snap) return;
+        job = snap;
+        wake.notify_one();
+    }
+    
+    bool pending() {
+        std::lock_guard<std::mutex> lk(lock);
+        return job != nullptr;
+    }
+    
+    unsigned version() const { return finished; }
+    
+    std::shared_ptr<const Analysis> latest() {
+        std::lock_guard<std::mutex> lk(lock);
+        return done;
+    }
+};
+
+struct HeatKey {
+    int zx, zy;
+    long tx, ty;
+    
+    bool operator==(const HeatKey& o) const { return zx == o.zx && zy == o.zy && tx == o.tx && ty == o.ty; }
+};
+
+struct HeatKeyHash {
+    size_t operator()(const HeatKey& k) const {
+        return std::hash<long>()(k.tx * 73856093L ^ k.ty * 19349663L ^ (static_cast<long>(k.zx) << 20) ^ k.zy);
+    }
+};
+
+struct HeatTile {
+    std::vector<float> vals;
+    std::vector<unsigned char> rgba;
+};
+
+// Scalar-field tiles of one equation, like map tiles: a tile at level (zx, zy)
+// spans 2^zx by 2^zy world units and holds tile x tile samples. Missing tiles are
+// evaluated in parallel in the background; finished tiles stay in an LRU bounded
+// by a byte budget, so panning and zooming back reuse them. Complex equations get
+// domain-coloured RGBA tiles instead of values.
+class HeatmapCache {
+public:
+    static const int tile = 128;
+    
+private:
+    typedef std::list<HeatKey> Lru;
+    
+    struct Entry {
+        std::shared_ptr<const HeatTile> data;
+        Lru::iterator pos;
+    };
+    
+    ThreadPool pool;
+    std::vector<std::function<void()>> tasks;
+    
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stopping;
+    bool hasJob;
+    std::shared_ptr<Equation> eq;
+    std::vector<HeatKey> wanted;
+    std::atomic<unsigned> generation;
+    std::atomic<unsigned> finished;
+    
+    Lru lru;
+    std::unordered_map<HeatKey, Entry, HeatKeyHash> tiles;
+    std::unordered_map<HeatKey, unsigned, HeatKeyHash> queued;
+    size_t budget;
+    std::thread worker;
+    
+    static size_t tileBytes() { return sizeof(HeatTile) + tile * tile * sizeof(float); }
+    
+    // Queued keys carry the equation generation they were queued under; a key
+    // dropped from the queue, or queued again for another equation, is not wanted.
+    bool wants(const HeatKey& k, unsigned gn) {
+        std::lock_guard<std::mutex> lk(lock);
+        auto q = queued.find(k);
+        return generation == gn && q != queued.end() && q->second == gn;
+    }
+    
+    void evict() {
+        while (!lru.empty() && tiles.size() * tileBytes() > budget) {
+            tiles.erase(lru.back());
+            lru.pop_back();
+        }
+    }
+    
+    static void evaluate(const Equation& e, const HeatKey& k, HeatTile& t) {
+        Scratch& s = Scratch::get();
+        size_t n = static_cast<size_t>(tile) * tile;
+        s.xs.resize(n);
+        s.ys.resize(n);
+        s.vals.resize(n);
+        double wx = ldexp(1.0, k.zx), wy = ldexp(1.0, k.zy);
+        for (int j = 0; j < tile; j++) {
+            double y = (k.ty + 1 - (j + 0.5) / tile) * wy;
+            for (int i = 0; i < tile; i++) {
+                s.xs[j * tile + i] = (k.tx + (i + 0.5) / tile) * wx;
+                s.ys[j * tile + i] = y;
+            }
+        }
+        e.evals += n;
+        if (e.prog.isComplex()) {
+            s.vals.resize(2 * n);
+            e.prog.evalComplexBatch(s.xs.data(), s.ys.data(), s.vals.data(), s.vals.data() + n, n);
+            t.rgba.resize(4 * n);
+            for (size_t i = 0; i < n; i++) domainColor(s.vals[i], s.vals[n + i], &t.rgba[4 * i]);
+            return;
+        }
+        e.prog.evalBatch(s.xs.data(), s.ys.data(), s.vals.data(), n);
+        t.vals.assign(s.vals.begin(), s.vals.end());
+    }
+    
+    void loop() {
+        while (true) {
+            std::shared_ptr<Equation> e;
+            std::vector<HeatKey> keys;
+            unsigned gn;
+            {
+                std::unique_lock<std::mutex> lk(lock);
+                wake.wait(lk, [this] { return stopping || hasJob; });
+                if (stopping) return;
+                hasJob = false;
+                e = eq;
+                keys.swap(wanted);
+                gn = generation;
+            }
+            
+            for (const HeatKey& k : keys) {
+                tasks.push_back([this, e, k, gn] {
+                    if (!wants(k, gn)) return;
+                    ProfileScope prof("heatTile", &e->text);
+                    std::shared_ptr<HeatTile> t = std::make_shared<HeatTile>();
+                    evaluate(*e, k, *t);
+                    
+                    std::lock_guard<std::mutex> lk(lock);
+                    auto q = queued.find(k);
+                    if (q != queued.end() && q->second == gn) queued.erase(q);
+                    if (e != eq) return;
+                    auto it = tiles.find(k);
+                    if (it != tiles.end()) {
+                        lru.splice(lru.begin(), lru, it->second.pos);
+                        it->second.data = t;
+                    } else {
+                        lru.push_front(k);
+                        tiles[k] = Entry{t, lru.begin()};
+                    }
+                    evict();
+                    finished++;
+                });
+            }
+            pool.run(tasks);
+        }
+    }
+    
+public:
+    explicit HeatmapCache(size_t budgetBytes = 64 << 20)
+        : stopping(false), hasJob(false), generation(0), finished(0), budget(budgetBytes) {
+        worker = std::thread(&HeatmapCache::loop, this);
+    }
+    
+    ~HeatmapCache() {
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            stopping = true;
+            generation++;
+        }
+        wake.notify_all();
+        worker.join();
+    }
+    
+    void setBudget(size_t bytes) {
+        std::lock_guard<std::mutex> lk(lock);
+        budget = bytes;
+        evict();
+    }
+    
+    size_t bytesUsed() {
+        std::lock_guard<std::mutex> lk(lock);
+        return tiles.size() * tileBytes();
+    }
+    
+    // Bumped whenever a tile lands, so callers can tell when to redraw.
+    unsigned version() const { return finished; }
+    
+    bool pending() {
+        std::lock_guard<std::mutex> lk(lock);
+        return !queued.empty();
+    }
+    
+    // Level whose tiles have at least one sample per pixel on each axis.
+    static void levels(const View& v, int& zx, int& zy) {
+        zx = static_cast<int>(floor(log2(tile * (v.xMax - v.xMin) / v.w)));
+        zy = static_cast<int>(floor(log2(tile * (v.yMax - v.yMin) / v.h)));
+    }
+    
+    static void range(const View& v, int zx, int zy, long& tx0, long& tx1, long& ty0, long& ty1) {
+        double wx = ldexp(1.0, zx), wy = ldexp(1.0, zy);
+        tx0 = static_cast<long>(floor(v.xMin / wx));
+        tx1 = static_cast<long>(floor(v.xMax / wx));
+        ty0 = static_cast<long>(floor(v.yMin / wy));
+        ty1 = static_cast<long>(floor(v.yMax / wy));
+    }
+    
+    // Queues the view's missing tiles, centre first. A different equation drops every cached tile;
+    // a null one leaves the cache as it is.
+    void request(const std::shared_ptr<Equation>& e, const View& v) {
+        int zx, zy;
+        long tx0, tx1, ty0, ty1;
+        levels(v, zx, zy);
+        range(v, zx, zy, tx0, tx1, ty0, ty1);
+        
+        if (!e) return;
+        std::lock_guard<std::mutex> lk(lock);
+        if (e != eq) {
+            eq = e;
+            tiles.clear();
+            lru.clear();
+            queued.clear();
+            wanted.clear();
+            generation++;
+        }
+        
+        // Queued tiles outside this view are superseded; those inside keep their place.
+        auto inView = [&](const HeatKey& k) {
+            return k.zx == zx && k.zy == zy && k.tx >= tx0 && k.tx <= tx1 && k.ty >= ty0 && k.ty <= ty1;
+        };
+        size_t before = queued.size();
+        for (auto it = queued.begin(); it != queued.end();) {
+            it = inView(it->first) ? std::next(it) : queued.erase(it);
+        }
+        bool dropped = queued.size() != before;
+        
+        std::vector<HeatKey> missing;
+        for (long tx = tx0; tx <= tx1; tx++) {
+            for (long ty = ty0; ty <= ty1; ty++) {
+                HeatKey k = {zx, zy, tx, ty};
+                if (!tiles.count(k) && !queued.count(k)) missing.push_back(k);
+            }
+        }
+        if (dropped) {
+            wanted.erase(std::remove_if(wanted.begin(), wanted.end(), [&](const HeatKey& k) { return !queued.count(k); }),
+                         wanted.end());
+        }
+        if (missing.empty()) return;
+        
+        double cx = (tx0 + tx1) / 2.0, cy = (ty0 + ty1) / 2.0;
+        std::sort(missing.begin(), missing.end(), [cx, cy](const HeatKey& a, const HeatKey& b) {
+            return fabs(a.tx - cx) + fabs(a.ty - cy) < fabs(b.tx - cx) + fabs(b.ty - cy);
+        });
+        
+        for (const HeatKey& k : missing) queued[k] = generation;
+        wanted.insert(wanted.end(), missing.begin(), missing.end());
+        hasJob = true;
+        wake.notify_one();
+    }
+    
+    // Marks the tile as recently used; null if it is not cached.
+    std::shared_ptr<const HeatTile> find(const HeatKey& k) {
+        std::lock_guard<std::mutex> lk(lock);
+        auto it = tiles.find(k);
+        if (it == tiles.end()) return nullptr;
+        lru.splice(lru.begin(), lru, it->second.pos);
+        return it->second.data;
+    }
+};
+
+// "MVDS", u32 version, u64 point count, then float64 x/y pairs sorted by x.
+// Native byte order. The points are mapped rather than read, and a min/max
+// pyramid over them lets any view decimate to about two points per column.
+class DataSeries {
+private:
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint64_t count;
+    };
+    
+    struct Bucket {
+        double lo, hi;
+    };
+    
+    static const size_t fanout = 16;
+    
+    std::string name, source;
+    std::string err;
+    void* map;
+    size_t mapLen;
+    std::vector<CurvePoint> owned;
+    const CurvePoint* pts;
+    size_t n;
+    std::vector<std::vector<Bucket>> levels;
+    
+    void release() {
+#ifdef MV_HAS_MMAP
+        if (map) munmap(map, mapLen);
+#endif
+        map = nullptr;
+        mapLen = 0;
+        owned.clear();
+        pts = nullptr;
+        n = 0;
+        levels.clear();
+    }
+    
+    bool fail(const std::string& msg) {
+        err = msg;
+        release();
+        return false;
+    }
+    
+    bool mapFile(const std::string& path) {
+#ifdef MV_HAS_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return fail("cannot open " + path);
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(Header))) {
+            ::close(fd);
+            return fail(path + " is not a data file");
+        }
+        mapLen = static_cast<size_t>(st.st_size);
+        map = mmap(nullptr, mapLen, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            map = nullptr;
+            return fail("cannot map " + path);
+        }
+        madvise(map, mapLen, MADV_SEQUENTIAL);
+        
+        Header hdr;
+        memcpy(&hdr, map, sizeof(Header));
+        if (memcmp(hdr.magic, "MVDS", 4) != 0 || hdr.version != 1 ||
+            hdr.count > (mapLen - sizeof(Header)) / sizeof(CurvePoint)) {
+            return fail(path + " is not a data file");
+        }
+        pts = reinterpret_cast<const CurvePoint*>(static_cast<const char*>(map) + sizeof(Header));
+        n = static_cast<size_t>(hdr.count);
+#else
+        std::ifstream f(path, std::ios::binary);
+        Header hdr;
+        if (!f.read(reinterpret_cast<char*>(&hdr), sizeof(Header)) ||
+            memcmp(hdr.magic, "MVDS", 4) != 0 || hdr.version != 1) {
+            return fail(path + " is not a data file");
+        }
+        owned.resize(static_cast<size_t>(hdr.count));
+        if (!f.read(reinterpret_cast<char*>(owned.data()), owned.size() * sizeof(CurvePoint))) {
+            return fail(path + " is truncated");
+        }
+        pts = owned.data();
+        n = owned.size();
+#endif
+        return true;
+    }
+    
+    bool build() {
+        if (n == 0) return true;
+        std::vector<Bucket> base((n + fanout - 1) / fanout, Bucket{INFINITY, -INFINITY});
+        double prev = -INFINITY;
+        for (size_t i = 0; i < n; i++) {
+            const CurvePoint& p = pts[i];
+            if (!(p.x >= prev) || !std::isfinite(p.x)) return fail(name + ": x values must be finite and ascending");
+            prev = p.x;
+            if (!std::isfinite(p.y)) continue;
+            Bucket& b = base[i / fanout];
+            b.lo = std::min(b.lo, p.y);
+            b.hi = std::max(b.hi, p.y);
+        }
+        levels.push_back(std::move(base));
+        
+        while (levels.back().size() > 1) {
+            const std::vector<Bucket>& fine = levels.back();
+            std::vector<Bucket> up((fine.size() + fanout - 1) / fanout, Bucket{INFINITY, -INFINITY});
+            for (size_t i = 0; i < fine.size(); i++) {
+                Bucket& b = up[i / fanout];
+                b.lo = std::min(b.lo, fine[i].lo);
+                b.hi = std::max(b.hi, fine[i].hi);
+            }
+            levels.push_back(std::move(up));
+        }
+        return true;
+    }
+    
+public:
+    DataSeries() : map(nullptr), mapLen(0), pts(nullptr), n(0) {}
+    ~DataSeries() { release(); }
+    
+    DataSeries(const DataSeries&) = delete;
+    DataSeries& operator=(const DataSeries&) = delete;
+    
+    const std::string& label() const { return name; }
+    const std::string& path() const { return source; }
+    const std::string& error() const { return err; }
+    size_t size() const { return n; }
+    
+    // Writes two-column CSV as MVDS, skipping lines that do not parse and sorting by x if needed.
+    static bool convertCsv(const std::string& csv, const std::string& out, std::string& error) {
+        std::ifstream in(csv);
+        if (!in) {
+            error = "cannot open " + csv;
+            return false;
+        }
+        
+        std::vector<CurvePoint> data;
+        std::string line;
+        while (std::getline(in, line)) {
+            const char* p = line.c_str();
+            char* end;
+            double x = strtod(p, &end);
+            if (end == p || !std::isfinite(x)) continue;
+            p = end;
+            while (*p == ',' || *p == ';' || *p == ' ' || *p == '\t') p++;
+            double y = strtod(p, &end);
+            if (end == p) y = NAN;
+            data.push_back({x, y});
+        }
+        if (!std::is_sorted(data.begin(), data.end(), [](const CurvePoint& a, const CurvePoint& b) { return a.x < b.x; })) {
+            std::stable_sort(data.begin(), data.end(), [](const CurvePoint& a, const CurvePoint& b) { return a.x < b.x; });
+        }
+        
+        FILE* f = fopen(out.c_str(), "wb");
+        if (!f) {
+            error = "cannot write " + out;
+            return false;
+        }
+        Header hdr = {{'M', 'V', 'D', 'S'}, 1, static_cast<uint64_t>(data.size())};
+        bool ok = fwrite(&hdr, sizeof(Header), 1, f) == 1 &&
+                  fwrite(data.data(), sizeof(CurvePoint), data.size(), f) == data.size();
+        ok = fclose(f) == 0 && ok;
+        if (!ok) {
+            remove(out.c_str());
+            error = "cannot write " + out;
+            return false;
+        }
+        return true;
+    }
+    
+    // A .csv path is converted once to a sibling .mvds file, refreshed when the CSV is newer.
+    bool open(const std::string& path) {
+        release();
+        err.clear();
+        source = path;
+        name = path.substr(path.find_last_of("/\\") + 1);
+        
+        std::string file = path;
+        if (path.size() > 4 && path.compare(path.size() - 4, 4, ".csv") == 0) {
+            file = path + ".mvds";
+            bool fresh = false;
+#ifdef MV_HAS_MMAP
+            struct stat a, b;
+            fresh = stat(path.c_str(), &a) == 0 && stat(file.c_str(), &b) == 0 && b.st_mtime >= a.st_mtime;
+#endif
+            if (!fresh && !convertCsv(path, file, err)) return false;
+        }
+        
+        ProfileScope prof("buildPyramid", &name);
+        return mapFile(file) && build();
+    }
+    
+    // Points of the visible range, about two per column; NaN y marks a gap.
+    void decimate(double xMin, double xMax, int columns, std::vector<CurvePoint>& out) const {
+        out.clear();
+        if (n == 0 || columns <= 0) return;
+        
+        auto less = [](const CurvePoint& p, double x) { return p.x < x; };
+        size_t i0 = std::lower_bound(pts, pts + n, xMin, less) - pts;
+        size_t i1 = std::lower_bound(pts + i0, pts + n, xMax, less) - pts;
+        if (i0 > 0) i0--;
+        if (i1 < n) i1++;
+        size_t count = i1 - i0;
+        
+        if (count <= 2 * static_cast<size_t>(columns) || levels.empty()) {
+            for (size_t i = i0; i < i1; i++) {
+                out.push_back({pts[i].x, std::isfinite(pts[i].y) ? pts[i].y : NAN});
+            }
+            return;
+        }
+        
+        // Coarsest level that still has at least one bucket per column.
+        size_t level = 0, span = fanout;
+        while (level + 1 < levels.size() && count / (span * fanout) >= static_cast<size_t>(columns)) {
+            level++;
+            span *= fanout;
+        }
+        const std::vector<Bucket>& bk = levels[level];
+        
+        double scale = columns / (xMax - xMin);
+        long col = LONG_MIN;
+        double lo = INFINITY, hi = -INFINITY, colX = 0;
+        auto flush = [&]() {
+            if (col == LONG_MIN) return;
+            if (lo > hi) {
+                out.push_back({colX, NAN});
+                return;
+            }
+            bool down = !out.empty() && std::isfinite(out.back().y) && out.back().y > (lo + hi) / 2;
+            out.push_back({colX, down ? hi : lo});
+            if (hi != lo) out.push_back({colX, down ? lo : hi});
+        };
+        
+        for (size_t b = i0 / span; b <= (i1 - 1) / span; b++) {
+            double x = pts[b * span].x;
+            long c = static_cast<long>(floor((x - xMin) * scale));
+            if (c != col) {
+                flush();
+                col = c;
+                colX = x;
+                lo = INFINITY;
+                hi = -INFINITY;
+            }
+            lo = std::min(lo, bk[b].lo);
+            hi = std::max(hi, bk[b].hi);
+        }
+        flush();
+    }
+};
+
+// "MVSC", u32 version, u64 key, the view the lines were sampled in and a u64
+// entry count, then per equation a u64 byte size followed by its text, the names
+// it reads, its compiled program and its sampled lines. Native byte order.
+// Compiled programs have parameter values and functions baked in, so the key
+// hashes those and a cache saved against other definitions is ignored. Entries
+// are decoded on lookup straight from the mapping.
+class SessionCache {
+private:
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint64_t key;
+        View view;
+        uint64_t count;
+    };
+    
+    struct Reader {
+        const char* p;
+        const char* end;
+        bool ok;
+        
+        bool fits(uint64_t n, size_t each) {
+            ok = ok && n <= static_cast<uint64_t>(end - p) / each;
+            return ok;
+        }
+        
+        template<class T> T get() {
+            T v = T();
+            if (fits(1, sizeof(T))) {
+                memcpy(&v, p, sizeof(T));
+                p += sizeof(T);
+            }
+            return v;
+        }
+        
+        std::string str() {
+            uint32_t n = get<uint32_t>();
+            if (!fits(n, 1)) return std::string();
+            std::string s(p, n);
+            p += n;
+            return s;
+        }
+    };
+    
+    static const Op lastOp = Op::Imag;
+    static const uint32_t version = 1 << 8 | static_cast<uint32_t>(lastOp);
+    
+    void* map;
+    size_t mapLen;
+    std::vector<char> owned;
+    const char* base;
+    Header hdr;
+    std::unordered_map<std::string, std::pair<size_t, size_t>> index;
+    
+    void release() {
+#ifdef MV_HAS_MMAP
+        if (map) munmap(map, mapLen);
+#endif
+        map = nullptr;
+        mapLen = 0;
+        owned.clear();
+        base = nullptr;
+        index.clear();
+    }
+    
+    bool mapFile(const std::string& path) {
+#ifdef MV_HAS_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(Header))) {
+            ::close(fd);
+            return false;
+        }
+        mapLen = static_cast<size_t>(st.st_size);
+        map = mmap(nullptr, mapLen, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            map = nullptr;
+            mapLen = 0;
+            return false;
+        }
+        base = static_cast<const char*>(map);
+#else
+        std::ifstream f(path, std::ios::binary);
+        if (!f) return false;
+        owned.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        if (owned.size() < sizeof(Header)) return false;
+        mapLen = owned.size();
+        base = owned.data();
+#endif
+        return true;
+    }
+    
+    // Replays the program's stack effects; a program that could leave its stack,
+    // temps or coefficient pool is rejected and its equation recompiled.
+    static bool verify(const Program& p) {
+        if (p.depth < 0 || p.temps < 0 || p.outputs != 1 || p.depth + p.temps > 1 << 16) return false;
+        std::vector<char> stored(static_cast<size_t>(p.temps), 0);
+        auto index = [](double v, size_t n) { return v >= 0 && v == floor(v) && v < static_cast<double>(n); };
+        int sp = 0, peak = 0;
+        for (const Instr& in : p.code) {
+            switch (in.op) {
+                case Op::VarY:
+                    if (!p.hasY) return false;
+                    sp++;
+                    break;
+                case Op::Imag:
+                    if (!p.cplx) return false;
+                    sp++;
+                    break;
+                case Op::Const: case Op::VarX:
+                    sp++;
+                    break;
+                case Op::Poly: {
+                    if (p.cplx || !index(in.val, p.coeffs.size())) return false;
+                    size_t off = static_cast<size_t>(in.val);
+                    if (p.coeffs.size() - off < 2) return false;
+                    double dx = p.coeffs[off], dy = p.coeffs[off + 1];
+                    if (!(dx >= 0 && dy >= 0 && dx == floor(dx) && dy == floor(dy) &&
+                          (dx + 1) * (dy + 1) <= static_cast<double>(p.coeffs.size() - off - 2))) {
+                        return false;
+                    }
+                    if (dy > 0 && !p.hasY) return false;
+                    sp++;
+                    break;
+                }
+                case Op::Load:
+                    if (!index(in.val, stored.size()) || !stored[static_cast<size_t>(in.val)]) return false;
+                    sp++;
+                    break;
+                case Op::Store:
+                    if (sp < 1 || !index(in.val, stored.size())) return false;
+                    stored[static_cast<size_t>(in.val)] = 1;
+                    break;
+                case Op::Add: case Op::Sub: case Op::Mul: case Op::Div: case Op::Pow:
+                    if (sp < 2) return false;
+                    sp--;
+                    break;
+                default:
+                    if (sp < 1) return false;
+                    break;
+            }
+            peak = std::max(peak, sp);
+        }
+        return peak <= p.depth && sp == p.outputs;
+    }
+    
+    static bool put(FILE* f, const void* p, size_t n) { return fwrite(p, 1, n, f) == n; }
+    
+    template<class T> static bool put(FILE* f, T v) { return fwrite(&v, sizeof(T), 1, f) == 1; }
+    
+    static void putStr(std::string& out, const std::string& s) {
+        uint32_t n = static_cast<uint32_t>(s.size());
+        out.append(reinterpret_cast<const char*>(&n), 4);
+        out.append(s);
+    }
+    
+    template<class T> static void putRaw(std::string& out, T v) { out.append(reinterpret_cast<const char*>(&v), sizeof(T)); }
+    
+    static std::string encode(const Equation& eq, const std::vector<std::vector<CurvePoint>>* lines) {
+        const Program& p = eq.prog;
+        std::string out;
+        putStr(out, eq.text);
+        putRaw(out, static_cast<uint32_t>(eq.uses.size()));
+        for (const std::string& u : eq.uses) putStr(out, u);
+        putRaw(out, static_cast<uint32_t>(p.code.size()));
+        for (const Instr& in : p.code) putRaw(out, static_cast<uint8_t>(in.op));
+        for (const Instr& in : p.code) putRaw(out, in.val);
+        putRaw(out, static_cast<uint32_t>(p.coeffs.size()));
+        out.append(reinterpret_cast<const char*>(p.coeffs.data()), p.coeffs.size() * sizeof(double));
+        putRaw(out, static_cast<int32_t>(p.depth));
+        putRaw(out, static_cast<int32_t>(p.temps));
+        putRaw(out, static_cast<int32_t>(p.outputs));
+        putRaw(out, static_cast<uint8_t>(p.hasY));
+        putRaw(out, static_cast<uint8_t>(p.cplx));
+        putRaw(out, static_cast<uint32_t>(lines ? lines->size() : 0));
+        if (!lines) return out;
+        for (const auto& line : *lines) {
+            putRaw(out, static_cast<uint64_t>(line.size()));
+            out.append(reinterpret_cast<const char*>(line.data()), line.size() * sizeof(CurvePoint));
+        }
+        return out;
+    }
+    
+public:
+    SessionCache() : map(nullptr), mapLen(0), base(nullptr), hdr() {}
+    ~SessionCache() { release(); }
+    
+    SessionCache(const SessionCache&) = delete;
+    SessionCache& operator=(const SessionCache&) = delete;
+    
+    // FNV-1a.
+    static uint64_t hash(const std::string& s) {
+        uint64_t h = 14695981039346656037ull;
+        for (unsigned char c : s) h = (h ^ c) * 1099511628211ull;
+        return h;
+    }
+    
+    // Lines come from the snapshot; equations it does not cover are stored without any.
+    static bool write(const std::string& path, uint64_t key, const std::vector<std::shared_ptr<Equation>>& eqs,
+                      const std::shared_ptr<const Snapshot>& snap) {
+        FILE* f = fopen(path.c_str(), "wb");
+        if (!f) return false;
+        Header h = {{'M', 'V', 'S', 'C'}, version, key, snap ? snap->view : View(), static_cast<uint64_t>(eqs.size())};
+        bool ok = put(f, &h, sizeof(Header));
+        for (const auto& eq : eqs) {
+            const std::vector<std::vector<CurvePoint>>* lines = nullptr;
+            if (snap) {
+                auto it = std::find(snap->eqs.begin(), snap->eqs.end(), eq);
+                if (it != snap->eqs.end()) lines = &snap->lines[it - snap->eqs.begin()];
+            }
+            std::string entry = encode(*eq, lines);
+            ok = ok && put(f, static_cast<uint64_t>(entry.size()));
+            ok = ok && put(f, entry.data(), entry.size());
+        }
+        ok = fclose(f) == 0 && ok;
+        if (!ok) remove(path.c_str());
+        return ok;
+    }
+    
+    // False when the file is missing, damaged, from another version or for another key.
+    bool open(const std::string& path, uint64_t key) {
+        release();
+        if (!mapFile(path)) {
+            release();
+            return false;
+        }
+        memcpy(&hdr, base, sizeof(Header));
+        if (memcmp(hdr.magic, "MVSC", 4) != 0 || hdr.version != version || hdr.key != key) {
+            release();
+            return false;
+        }
+        
+        Reader r = {base + sizeof(Header), base + mapLen, true};
+        for (uint64_t i = 0; i < hdr.count; i++) {
+            uint64_t size = r.get<uint64_t>();
+            if (!r.fits(size, 1)) break;
+            Reader e = {r.p, r.p + size, true};
+            std::string text = e.str();
+            if (e.ok) index[text] = std::make_pair(static_cast<size_t>(r.p - base), static_cast<size_t>(size));
+            r.p += size;
+        }
+        if (!r.ok) release();
+        return r.ok;
+    }
+    
+    void close() { release(); }
+    
+    const View& view() const { return hdr.view; }
+    
+    // A fresh equation with the cached program, or null; lines gets its cached geometry.
+    std::shared_ptr<Equation> find(const std::string& text, std::vector<std::vector<CurvePoint>>& lines) const {
+        lines.clear();
+        auto it = index.find(text);
+        if (it == index.end()) return nullptr;
+        Reader r = {base + it->second.first, base + it->second.first + it->second.second, true};
+        r.str();
+        
+        std::set<std::string> uses;
+        for (uint32_t n = r.get<uint32_t>(); r.ok && n > 0; n--) uses.insert(r.str());
+        
+        Program p;
+        uint32_t n = r.get<uint32_t>();
+        if (!r.fits(n, 1 + sizeof(double))) return nullptr;
+        p.code.resize(n);
+        for (Instr& in : p.code) {
+            uint8_t op = r.get<uint8_t>();
+            if (op > static_cast<uint8_t>(lastOp)) return nullptr;
+            in.op = static_cast<Op>(op);
+        }
+        for (Instr& in : p.code) in.val = r.get<double>();
+        n = r.get<uint32_t>();
+        if (!r.fits(n, sizeof(double))) return nullptr;
+        p.coeffs.resize(n);
+        for (double& c : p.coeffs) c = r.get<double>();
+        p.depth = r.get<int32_t>();
+        p.temps = r.get<int32_t>();
+        p.outputs = r.get<int32_t>();
+        p.hasY = r.get<uint8_t>() != 0;
+        p.cplx = r.get<uint8_t>() != 0;
+        if (!r.ok || !verify(p)) return nullptr;
+        
+        n = r.get<uint32_t>();
+        if (!r.fits(n, sizeof(uint64_t))) return nullptr;
+        lines.resize(n);
+        for (auto& line : lines) {
+            uint64_t pts = r.get<uint64_t>();
+            if (!r.fits(pts, sizeof(CurvePoint))) break;
+            line.resize(static_cast<size_t>(pts));
+            memcpy(line.data(), r.p, line.size() * sizeof(CurvePoint));
+            r.p += line.size() * sizeof(CurvePoint);
+        }
+        if (!r.ok) {
+            lines.clear();
+            return nullptr;
+        }
+        
+        std::shared_ptr<Equation> eq = std::make_shared<Equation>(text, std::move(p));
+        eq->uses = uses;
+        return eq;
+    }
+};
+
+#endif
@@ -0,0 +1,1274 @@
+#ifndef MATH_PLOTTER_HPP
+#define MATH_PLOTTER_HPP
+
+#include <SFML/Graphics.hpp>
+#include "math_engine.hpp"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <fstream>
+
+class InputBox {
+private:
+    sf::RectangleShape bg;
+    sf::RectangleShape border;
+    std::string txt;
+    bool active;
+    sf::Font* fnt;
+    sf::Text display;
+    sf::Text lbl;
+    float timer;
+    bool cursor;
+    std::string shown;
+    bool dirty;
+    
+public:
+    InputBox(float x, float y, float w, float h, const std::string& label = "") 
+        : active(false), fnt(nullptr), timer(0), cursor(false), dirty(true) {
+        bg.setPosition(x, y);
+        bg.setSize(sf::Vector2f(w, h));
+        bg.setFillColor(sf::Color(30, 30, 30));
+        
+        border.setPosition(x - 2, y - 2);
+        border.setSize(sf::Vector2f(w + 4, h + 4));
+        border.setFillColor(sf::Color::Transparent);
+        border.setOutlineThickness(2);
+        border.setOutlineColor(sf::Color(100, 100, 100));
+        
+        display.setPosition(x + 5, y + 5);
+        display.setFillColor(sf::Color::White);
+        display.setCharacterSize(16);
+        
+        lbl.setString(label);
+        lbl.setPosition(x, y - 20);
+        lbl.setFillColor(sf::Color::White);
+        lbl.setCharacterSize(14);
+    }
+    
+    void setFont(sf::Font& f) {
+        fnt = &f;
+        display.setFont(f);
+        lbl.setFont(f);
+        dirty = true;
+    }
+    
+    void setActive(bool a) {
+        if (a == active) return;
+        active = a;
+        border.setOutlineColor(a ? sf::Color::Green : sf::Color(100, 100, 100));
+        refresh();
+        dirty = true;
+    }
+    
+    bool isActive() const { return active; }
+    
+    void handleText(sf::Uint32 unicode) {
+        if (!active) return;
+        if (unicode == 8) {
+            if (!txt.empty()) txt.pop_back();
+        } else if (unicode >= 32 && unicode < 127) {
+            txt += static_cast<char>(unicode);
+        }
+        refresh();
+    }
+    
+    void refresh() {
+        std::string s = txt + (cursor && active ? "|" : "");
+        if (fnt && s != shown) {
+            shown = s;
+            display.setString(s);
+            dirty = true;
+        }
+    }
+    
+    // True once after anything visible changed.
+    bool takeDirty() {
+        bool d = dirty;
+        dirty = false;
+        return d;
+    }
+    
+    // Seconds until the cursor blinks, or a negative value when nothing will change by itself.
+    float untilBlink() const { return active ? 0.5f - timer : -1; }
+    
+    void update(float dt) {
+        timer += dt;
+        if (timer > 0.5f) {
+            cursor = !cursor;
+            timer = 0;
+            refresh();
+        }
+    }
+    
+    void draw(sf::RenderWindow& win) {
+        if (fnt) win.draw(lbl);
+        win.draw(border);
+        win.draw(bg);
+        if (fnt) win.draw(display);
+    }
+    
+    std::string getText() const { return txt; }
+    void clear() { 
+        txt.clear(); 
+        refresh();
+    }
+    
+    bool contains(sf::Vector2f pt) {
+        return bg.getGlobalBounds().contains(pt);
+    }
+};
+
+// Lays out each string's glyph quads once and batches every string of one
+// character size into a single textured draw.
+class TextBatch {
+private:
+    const sf::Font* font;
+    unsigned size;
+    sf::VertexArray verts;
+    std::unordered_map<std::string, std::vector<sf::Vertex>> layouts;
+    
+public:
+    explicit TextBatch(unsigned charSize) : font(nullptr), size(charSize), verts(sf::Triangles) {}
+    
+    void setFont(const sf::Font& f) {
+        font = &f;
+        layouts.clear();
+    }
+    
+    void forget() { layouts.clear(); }
+    size_t cached() const { return layouts.size(); }
+    
+    const std::vector<sf::Vertex>& layout(const std::string& s) {
+        auto it = layouts.find(s);
+        if (it != layouts.end()) return it->second;
+        
+        std::vector<sf::Vertex>& quads = layouts[s];
+        if (!font) return quads;
+        float x = 0, y = static_cast<float>(size);
+        sf::Uint32 prev = 0;
+        for (unsigned char ch : s) {
+            sf::Uint32 c = ch;
+            x += font->getKerning(prev, c, size);
+            prev = c;
+            const sf::Glyph& g = font->getGlyph(c, size, false);
+            float l = x + g.bounds.left, t = y + g.bounds.top;
+            float r = l + g.bounds.width, b = t + g.bounds.height;
+            float u0 = static_cast<float>(g.textureRect.left), v0 = static_cast<float>(g.textureRect.top);
+            float u1 = u0 + g.textureRect.width, v1 = v0 + g.textureRect.height;
+            x += g.advance;
+            if (g.bounds.width <= 0 || g.bounds.height <= 0) continue;
+            
+            sf::Color white = sf::Color::White;
+            quads.push_back(sf::Vertex(sf::Vector2f(l, t), white, sf::Vector2f(u0, v0)));
+            quads.push_back(sf::Vertex(sf::Vector2f(r, t), white, sf::Vector2f(u1, v0)));
+            quads.push_back(sf::Vertex(sf::Vector2f(l, b), white, sf::Vector2f(u0, v1)));
+            quads.push_back(sf::Vertex(sf::Vector2f(l, b), white, sf::Vector2f(u0, v1)));
+            quads.push_back(sf::Vertex(sf::Vector2f(r, t), white, sf::Vector2f(u1, v0)));
+            quads.push_back(sf::Vertex(sf::Vector2f(r, b), white, sf::Vector2f(u1, v1)));
+        }
+        return quads;
+    }
+    
+    void clear() { verts.clear(); }
+    size_t vertexCount() const { return verts.getVertexCount(); }
+    
+    void add(const std::vector<sf::Vertex>& quads, sf::Vector2f pos, sf::Color col) {
+        for (sf::Vertex v : quads) {
+            v.position += pos;
+            v.color = col;
+            verts.append(v);
+        }
+    }
+    
+    void draw(sf::RenderTarget& target) const {
+        if (!font || verts.getVertexCount() == 0) return;
+        sf::RenderStates states;
+        states.texture = &font->getTexture(size);
+        target.draw(verts, states);
+    }
+};
+
+// A recorded interaction: one event per line, the milliseconds since recording
+// started, then the event's name and fields, e.g. "1532.4 wheel 1 600 350".
+// Only the event types App reacts to are written.
+class EventLog {
+private:
+    struct Entry {
+        double ms;
+        sf::Event e;
+    };
+    
+    std::vector<Entry> entries;
+    size_t next;
+    std::ofstream out;
+    sf::Clock clock;
+    
+public:
+    EventLog() : next(0) {}
+    
+    bool record(const std::string& path) {
+        out.open(path);
+        out << std::fixed << std::setprecision(1);
+        clock.restart();
+        return static_cast<bool>(out);
+    }
+    
+    bool recording() const { return out.is_open(); }
+    
+    void write(const sf::Event& e) {
+        if (!out.is_open()) return;
+        double ms = clock.getElapsedTime().asMicroseconds() / 1000.0;
+        switch (e.type) {
+            case sf::Event::Closed: out << ms << " closed\n"; break;
+            case sf::Event::GainedFocus: out << ms << " focus\n"; break;
+            case sf::Event::Resized: out << ms << " resized " << e.size.width << " " << e.size.height << "\n"; break;
+            case sf::Event::MouseButtonPressed:
+            case sf::Event::MouseButtonReleased:
+                out << ms << (e.type == sf::Event::MouseButtonPressed ? " press " : " release ")
+                    << e.mouseButton.button << " " << e.mouseButton.x << " " << e.mouseButton.y << "\n";
+                break;
+            case sf::Event::MouseMoved: out << ms << " move " << e.mouseMove.x << " " << e.mouseMove.y << "\n"; break;
+            case sf::Event::MouseWheelScrolled:
+                out << ms << " wheel " << e.mouseWheelScroll.delta << " " << e.mouseWheelScroll.x << " " << e.mouseWheelScroll.y << "\n";
+                break;
+            case sf::Event::TextEntered: out << ms << " text " << e.text.unicode << "\n"; break;
+            case sf::Event::KeyPressed: out << ms << " key " << e.key.code << "\n"; break;
+            default: break;
+        }
+        out.flush();
+    }
+    
+    // Lines that do not parse are skipped rather than failing the whole log.
+    bool load(const std::string& path) {
+        std::ifstream in(path);
+        if (!in) return false;
+        entries.clear();
+        next = 0;
+        std::string line, type;
+        while (std::getline(in, line)) {
+            std::istringstream ls(line);
+            Entry en;
+            en.e = sf::Event();
+            if (!(ls >> en.ms >> type)) continue;
+            int a = 0, b = 0, c = 0;
+            float f = 0;
+            sf::Event& e = en.e;
+            if (type == "closed") {
+                e.type = sf::Event::Closed;
+            } else if (type == "focus") {
+                e.type = sf::Event::GainedFocus;
+            } else if (type == "resized" && ls >> a >> b) {
+                e.type = sf::Event::Resized;
+                e.size.width = a;
+                e.size.height = b;
+            } else if ((type == "press" || type == "release") && ls >> a >> b >> c) {
+                e.type = type == "press" ? sf::Event::MouseButtonPressed : sf::Event::MouseButtonReleased;
+                e.mouseButton.button = static_cast<sf::Mouse::Button>(a);
+                e.mouseButton.x = b;
+                e.mouseButton.y = c;
+            } else if (type == "move" && ls >> a >> b) {
+                e.type = sf::Event::MouseMoved;
+                e.mouseMove.x = a;
+                e.mouseMove.y = b;
+            } else if (type == "wheel" && ls >> f >> b >> c) {
+                e.type = sf::Event::MouseWheelScrolled;
+                e.mouseWheelScroll.wheel = sf::Mouse::VerticalWheel;
+                e.mouseWheelScroll.delta = f;
+                e.mouseWheelScroll.x = b;
+                e.mouseWheelScroll.y = c;
+            } else if (type == "text" && ls >> a) {
+                e.type = sf::Event::TextEntered;
+                e.text.unicode = a;
+            } else if (type == "key" && ls >> a) {
+                e.type = sf::Event::KeyPressed;
+                e.key.code = static_cast<sf::Keyboard::Key>(a);
+            } else {
+                continue;
+            }
+            entries.push_back(en);
+        }
+        return true;
+    }
+    
+    bool finished() const { return next >= entries.size(); }
+    double nextMs() const { return finished() ? 0 : entries[next].ms; }
+    
+    // The next event once replay time has reached it.
+    bool poll(double ms, sf::Event& e) {
+        if (finished() || entries[next].ms > ms) return false;
+        e = entries[next++].e;
+        return true;
+    }
+};
+
+class Plotter {
+private:
+    sf::RenderTarget& win;
+    Parser parser;
+    sf::Font font;
+    bool hasFont;
+    
+    double xMin, xMax, yMin, yMax;
+    int w, h;
+    Symbols symbols;
+    std::vector<std::shared_ptr<Equation>> eqs;
+    std::vector<sf::Color> cols;
+    Sampler sampler;
+    
+    struct FrameStats {
+        Counter stageNs[8];
+        std::vector<Counter> eqDrawNs, eqSampleNs;
+        std::vector<size_t> evalsSeen, sampleSeen;
+        size_t evals = 0, vertices = 0;
+        double frameMs = 0;
+        int frames = 0;
+    };
+    
+    sf::VertexArray gridLines, axisLines;
+    sf::VertexBuffer curveBuf;
+    std::vector<sf::Vertex> curveVerts;
+    std::shared_ptr<const Snapshot> uploaded;
+    std::vector<std::shared_ptr<Equation>> uploadedEqs;
+    
+    struct HeatTexture {
+        std::shared_ptr<const HeatTile> src;
+        sf::Texture tex;
+        bool used = false;
+    };
+    
+    bool heatmap, domain;
+    std::shared_ptr<Equation> domainEq;
+    HeatmapCache heat;
+    std::unordered_map<HeatKey, HeatTexture, HeatKeyHash> heatTex;
+    std::vector<sf::Uint8> heatPixels;
+    sf::VertexArray heatQuad;
+    
+    std::vector<std::shared_ptr<DataSeries>> data;
+    std::vector<CurvePoint> dataPts;
+    sf::VertexArray dataLines;
+    
+    TextBatch labelText, listText;
+    std::unordered_map<double, const std::vector<sf::Vertex>*> labelLayouts;
+    double labelStepX, labelStepY;
+    std::vector<std::shared_ptr<Equation>> listed;
+    size_t listedData;
+    std::shared_ptr<Equation> listedDomain;
+    
+    TextBatch sliderText;
+    sf::VertexArray sliderShapes;
+    std::string activeSlider;
+    
+    bool marking;
+    Analyzer analyzer;
+    TextBatch markText;
+    sf::VertexArray markShapes;
+    
+    bool dirty;
+    unsigned drawnHeat, drawnMarks;
+    
+    bool profiling;
+    FrameStats stats;
+    std::vector<std::string> report;
+    sf::Clock frameClock, reportClock;
+    
+    sf::Vector2f toScreen(double x, double y) {
+        float sx = static_cast<float>((x - xMin) / (xMax - xMin) * w);
+        float sy = static_cast<float>(h - (y - yMin) / (yMax - yMin) * h);
+        return sf::Vector2f(sx, sy);
+    }
+    
+    void toWorld(float sx, float sy, double& wx, double& wy) {
+        wx = xMin + (sx / w) * (xMax - xMin);
+        wy = yMax - (sy / h) * (yMax - yMin);
+    }
+    
+    std::shared_ptr<Equation> build(const std::string& text) {
+        std::set<std::string> uses;
+        std::shared_ptr<Equation> eq = std::make_shared<Equation>(text, parser.compile(text, symbols, &uses));
+        eq->uses = uses;
+        return eq;
+    }
+    
+    std::shared_ptr<Equation> buildComplex(const std::string& text) {
+        std::set<std::string> uses;
+        std::shared_ptr<Equation> eq = std::make_shared<Equation>(text, parser.compileComplex(text, symbols, &uses));
+        eq->uses = uses;
+        return eq;
+    }
+    
+    // Only equations the changed name reaches get a new Equation, and with it an
+    // empty cache; the sampler keeps every other equation's samples.
+    void changed(const std::string& name) {
+        for (auto& eq : eqs) {
+            if (symbols.reaches(eq->uses, name)) eq = build(eq->text);
+        }
+        if (domainEq && symbols.reaches(domainEq->uses, name)) domainEq = buildComplex(domainEq->text);
+    }
+    
+    // Function and parameter lines of a session file. Compiled programs have these
+    // baked in, so they also key the session cache.
+    std::string symbolLines() const {
+        std::ostringstream out;
+        out.precision(17);
+        for (const auto& f : symbols.funcs) {
+            out << "func " << f.first << "(";
+            for (size_t i = 0; i < f.second.args.size(); i++) out << (i ? "," : "") << f.second.args[i];
+            out << ") = " << f.second.body << "\n";
+        }
+        for (const auto& p : symbols.params) {
+            out << "param " << p.first << " " << p.second.value << " " << p.second.lo << " " << p.second.hi << "\n";
+        }
+        return out.str();
+    }
+    
+    float sliderTop() const { return 20.0f + (eqs.size() + data.size() + (domainEq ? 1 : 0)) * 20.0f; }
+    
+    std::string fmtNum(double n) {
+        if (fabs(n) < 0.001 && n != 0) return "0";
+        if (fabs(n) > 9999) {
+            std::ostringstream oss;
+            oss << std::scientific << std::setprecision(0) << n;
+            return oss.str();
+        }
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(1) << n;
+        std::string result = oss.str();
+        result.erase(result.find_last_not_of('0') + 1, std::string::npos);
+        result.erase(result.find_last_not_of('.') + 1, std::string::npos);
+        return result;
+    }
+    
+public:
+    Plotter(sf::RenderTarget& window)
+        : win(window), hasFont(false), xMin(-10), xMax(10), yMin(-10), yMax(10),
+          gridLines(sf::Lines), axisLines(sf::Lines), curveBuf(sf::Lines, sf::VertexBuffer::Static),
+          heatmap(false), domain(false), heatQuad(sf::TriangleStrip, 4), dataLines(sf::Lines), labelText(12), listText(14), labelStepX(0), labelStepY(0), listedData(0),
+          sliderText(12), sliderShapes(sf::Triangles), marking(false), markText(11), markShapes(sf::Triangles),
+          dirty(true), drawnHeat(0), drawnMarks(0), profiling(false) {
+        w = static_cast<int>(win.getSize().x);
+        h = static_cast<int>(win.getSize().y - 100);
+        
+        if (font.loadFromFile("/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf") ||
+            font.loadFromFile("/System/Library/Fonts/Arial.ttf") ||
+            font.loadFromFile("C:/Windows/Fonts/arial.ttf")) {
+            hasFont = true;
+            labelText.setFont(font);
+            listText.setFont(font);
+            sliderText.setFont(font);
+            markText.setFont(font);
+        }
+        
+        cols = {sf::Color::Red, sf::Color::Blue, sf::Color::Green, sf::Color::Yellow,
+                sf::Color::Magenta, sf::Color::Cyan, sf::Color(255, 165, 0), sf::Color(128, 0, 128)};
+    }
+    
+    sf::Font* getFont() { return hasFont ? &font : nullptr; }
+    
+    // Takes an equation, or a definition such as "a = 2" or "f(x) = x^2 + a".
+    // Single-letter names an equation reads but nobody defined become parameters,
+    // except z: an equation in z is a complex function and replaces the one shown
+    // in domain-colouring mode.
+    void add(const std::string& eq) {
+        if (eq.empty()) return;
+        dirty = true;
+        
+        std::string name;
+        if (parser.define(eq, symbols, name)) {
+            changed(name);
+            std::cout << "Defined: " << name << std::endl;
+            return;
+        }
+        
+        std::set<std::string> unknown;
+        parser.compile(eq, symbols, nullptr, &unknown);
+        if (unknown.count("z")) {
+            unknown.clear();
+            parser.compileComplex(eq, symbols, nullptr, &unknown);
+            for (const std::string& n : unknown) symbols.params[n] = {1, -10, 10};
+            domainEq = buildComplex(eq);
+            domain = true;
+            std::cout << "Added: f(z) = " << eq << std::endl;
+            return;
+        }
+        for (const std::string& n : unknown) symbols.params[n] = {1, -10, 10};
+        eqs.push_back(build(eq));
+        std::cout << "Added: " << eq << std::endl;
+    }
+    
+    void setParam(const std::string& name, double value) {
+        auto it = symbols.params.find(name);
+        if (it == symbols.params.end() || it->second.value == value) return;
+        dirty = true;
+        it->second.value = value;
+        changed(name);
+    }
+    
+    bool sliding() const { return !activeSlider.empty(); }
+    
+    bool grabSlider(sf::Vector2f p) {
+        float y = sliderTop();
+        for (const auto& prm : symbols.params) {
+            if (p.x >= 4 && p.x <= 216 && p.y >= y + 12 && p.y <= y + 28) {
+                activeSlider = prm.first;
+                dirty = true;
+                dragSlider(p.x);
+                return true;
+            }
+            y += 30;
+        }
+        return false;
+    }
+    
+    // Snaps to 1/200 of the slider's range so small mouse moves do not resample.
+    void dragSlider(float x) {
+        auto it = symbols.params.find(activeSlider);
+        if (it == symbols.params.end()) return;
+        const Symbols::Param& prm = it->second;
+        double t = std::max(0.0, std::min(1.0, (x - 10) / 200.0));
+        setParam(activeSlider, prm.lo + round(t * 200) * (prm.hi - prm.lo) / 200);
+    }
+    
+    void releaseSlider() {
+        if (activeSlider.empty()) return;
+        activeSlider.clear();
+        dirty = true;
+    }
+    
+    bool addData(const std::string& path) {
+        for (const auto& d : data) {
+            if (d->path() == path) return true;
+        }
+        std::shared_ptr<DataSeries> series = std::make_shared<DataSeries>();
+        if (!series->open(path)) {
+            std::cerr << series->error() << std::endl;
+            return false;
+        }
+        data.push_back(series);
+        dirty = true;
+        std::cout << "Loaded: " << series->label() << " (" << series->size() << " points)" << std::endl;
+        return true;
+    }
+    
+    void clear() {
+        dirty = true;
+        eqs.clear();
+        data.clear();
+        domainEq = nullptr;
+        domain = false;
+        symbols = Symbols();
+        activeSlider.clear();
+        std::cout << "Cleared" << std::endl;
+    }
+    
+    // Text: a "mvsession 1" line, then the view, modes, colour palette, functions,
+    // parameters, equations in order, the complex function and data files, one per
+    // line. Compiled programs and the last sampled lines go to FILE.cache.
+    bool saveSession(const std::string& path) {
+        std::ofstream out(path);
+        if (!out) return false;
+        out.precision(17);
+        out << "mvsession 1\n";
+        out << "view " << xMin << " " << xMax << " " << yMin << " " << yMax << "\n";
+        out << "heatmap " << heatmap << "\ndomain " << domain << "\nmarks " << marking << "\n";
+        out << "palette" << std::hex << std::setfill('0');
+        for (const sf::Color& c : cols) out << " " << std::setw(6) << (c.r << 16 | c.g << 8 | c.b);
+        out << std::dec << "\n" << symbolLines();
+        for (const auto& eq : eqs) out << "eq " << eq->text << "\n";
+        if (domainEq) out << "complex " << domainEq->text << "\n";
+        for (const auto& d : data) out << "data " << d->path() << "\n";
+        out.close();
+        if (!out) return false;
+        
+        std::vector<std::shared_ptr<Equation>> all = eqs;
+        if (domainEq) all.push_back(domainEq);
+        return SessionCache::write(path + ".cache", SessionCache::hash(symbolLines()), all, sampler.latest());
+    }
+    
+    // For a fresh plotter. Equations found in the cache skip compilation and their
+    // cached lines are drawn until the sampler's first pass replaces them; the rest
+    // are added as if typed.
+    bool loadSession(const std::string& path) {
+        std::ifstream in(path);
+        std::string line;
+        if (!in || !std::getline(in, line) || line != "mvsession 1") return false;
+        
+        std::vector<std::string> funcs, texts, files;
+        std::string complexText;
+        bool heat = false, dom = false, marks = false;
+        while (std::getline(in, line)) {
+            std::istringstream ss(line);
+            std::string key, rest;
+            ss >> key;
+            std::getline(ss >> std::ws, rest);
+            std::istringstream args(rest);
+            if (key == "view") {
+                double a, b, c, d;
+                if (args >> a >> b >> c >> d && b > a && d > c) setView(a, b, c, d);
+            } else if (key == "heatmap") {
+                heat = rest == "1";
+            } else if (key == "domain") {
+                dom = rest == "1";
+            } else if (key == "marks") {
+                marks = rest == "1";
+            } else if (key == "palette") {
+                std::vector<sf::Color> pal;
+                for (std::string hex; args >> hex;) {
+                    unsigned long v = strtoul(hex.c_str(), nullptr, 16);
+                    pal.push_back(sf::Color((v >> 16) & 0xff, (v >> 8) & 0xff, v & 0xff));
+                }
+                if (!pal.empty()) cols = pal;
+            } else if (key == "func") {
+                funcs.push_back(rest);
+            } else if (key == "param") {
+                std::string name;
+                Symbols::Param prm;
+                if (args >> name >> prm.value >> prm.lo >> prm.hi) symbols.params[name] = prm;
+            } else if (key == "eq") {
+                texts.push_back(rest);
+            } else if (key == "complex") {
+                complexText = rest;
+            } else if (key == "data") {
+                files.push_back(rest);
+            }
+        }
+        
+        // Twice, so each function's names include functions defined after it.
+        std::string name;
+        for (int pass = 0; pass < 2; pass++) {
+            for (const std::string& f : funcs) parser.define(f, symbols, name);
+        }
+        
+        SessionCache cache;
+        bool warm = cache.open(path + ".cache", SessionCache::hash(symbolLines()));
+        std::shared_ptr<Snapshot> snap = std::make_shared<Snapshot>();
+        snap->view = cache.view();
+        snap->coarse = true;
+        std::vector<std::vector<CurvePoint>> lines;
+        size_t hits = 0;
+        auto restore = [&](const std::string& text, bool complex) {
+            std::shared_ptr<Equation> eq = warm ? cache.find(text, lines) : nullptr;
+            if (!eq || eq->prog.isComplex() != complex) {
+                add(text);
+                return;
+            }
+            hits++;
+            if (complex) {
+                domainEq = eq;
+                return;
+            }
+            eqs.push_back(eq);
+            snap->eqs.push_back(eq);
+            snap->lines.push_back(lines);
+        };
+        for (const std::string& text : texts) restore(text, false);
+        if (!complexText.empty()) restore(complexText, true);
+        if (!snap->eqs.empty()) sampler.seed(snap);
+        for (const std::string& f : files) addData(f);
+        
+        heatmap = heat;
+        domain = dom && domainEq;
+        marking = marks;
+        dirty = true;
+        std::cout << "Loaded session: " << path << " (" << texts.size() + !complexText.empty() << " equations, "
+                  << hits << " cached)" << std::endl;
+        return true;
+    }
+    
+    void setView(double xmin, double xmax, double ymin, double ymax) {
+        dirty = true;
+        xMin = xmin; xMax = xmax; yMin = ymin; yMax = ymax;
+    }
+    
+    void zoom(float factor, sf::Vector2f center) {
+        dirty = true;
+        double cx, cy;
+        toWorld(center.x, center.y, cx, cy);
+        
+        double rx = (xMax - xMin) * factor;
+        double ry = (yMax - yMin) * factor;
+        
+        xMin = cx - rx / 2;
+        xMax = cx + rx / 2;
+        yMin = cy - ry / 2;
+        yMax = cy + ry / 2;
+    }
+    
+    void pan(float dx, float dy) {
+        dirty = true;
+        double wx = dx * (xMax - xMin) / w;
+        double wy = -dy * (yMax - yMin) / h;
+        
+        xMin -= wx; xMax -= wx;
+        yMin -= wy; yMax -= wy;
+    }
+    
+    void drawGrid() {
+        sf::VertexArray& grid = gridLines;
+        grid.clear();
+        
+        double rx = xMax - xMin;
+        double ry = yMax - yMin;
+        
+        double sx = pow(10, floor(log10(rx / 10)));
+        double sy = pow(10, floor(log10(ry / 10)));
+        
+        if (rx / sx < 5) sx /= 2;
+        if (ry / sy < 5) sy /= 2;
+        
+        double startX = ceil(xMin / sx) * sx;
+        for (double x = startX; x <= xMax; x += sx) {
+            sf::Vector2f top = toScreen(x, yMax);
+            sf::Vector2f bot = toScreen(x, yMin);
+            sf::Color gc = (fabs(x) < sx / 2) ? sf::Color(80, 80, 80) : sf::Color(40, 40, 40);
+            grid.append(sf::Vertex(top, gc));
+            grid.append(sf::Vertex(bot, gc));
+        }
+        
+        double startY = ceil(yMin / sy) * sy;
+        for (double y = startY; y <= yMax; y += sy) {
+            sf::Vector2f left = toScreen(xMin, y);
+            sf::Vector2f right = toScreen(xMax, y);
+            sf::Color gc = (fabs(y) < sy / 2) ? sf::Color(80, 80, 80) : sf::Color(40, 40, 40);
+            grid.append(sf::Vertex(left, gc));
+            grid.append(sf::Vertex(right, gc));
+        }
+        
+        stats.vertices += grid.getVertexCount();
+        win.draw(grid);
+    }
+    
+    void drawAxes() {
+        sf::VertexArray& axes = axisLines;
+        axes.clear();
+        
+        if (yMin <= 0 && yMax >= 0) {
+            sf::Vector2f left = toScreen(xMin, 0);
+            sf::Vector2f right = toScreen(xMax, 0);
+            axes.append(sf::Vertex(left, sf::Color::White));
+            axes.append(sf::Vertex(right, sf::Color::White));
+        }
+        
+        if (xMin <= 0 && xMax >= 0) {
+            sf::Vector2f top = toScreen(0, yMax);
+            sf::Vector2f bot = toScreen(0, yMin);
+            axes.append(sf::Vertex(top, sf::Color::White));
+            axes.append(sf::Vertex(bot, sf::Color::White));
+        }
+        
+        stats.vertices += axes.getVertexCount();
+        win.draw(axes);
+    }
+    
+    static sf::Color heatColor(float v) {
+        if (!std::isfinite(v)) return sf::Color::Black;
+        float t = v / (1 + fabsf(v));
+        if (t >= 0) return sf::Color(static_cast<sf::Uint8>(255 * t), static_cast<sf::Uint8>(90 * t), 0);
+        return sf::Color(0, static_cast<sf::Uint8>(-110 * t), static_cast<sf::Uint8>(-255 * t));
+    }
+    
+    std::shared_ptr<Equation> heatSource() const {
+        for (auto it = eqs.rbegin(); it != eqs.rend(); ++it) {
+            if ((*it)->prog.usesY()) return *it;
+        }
+        return nullptr;
+    }
+    
+    const sf::Texture* heatTexture(const HeatKey& k) {
+        std::shared_ptr<const HeatTile> tile = heat.find(k);
+        if (!tile) return nullptr;
+        
+        HeatTexture& ht = heatTex[k];
+        ht.used = true;
+        if (ht.src != tile) {
+            const int T = HeatmapCache::tile;
+            heatPixels.resize(T * T * 4);
+            if (!tile->rgba.empty()) {
+                std::copy(tile->rgba.begin(), tile->rgba.end(), heatPixels.begin());
+            } else {
+                for (int i = 0; i < T * T; i++) {
+                    sf::Color c = heatColor(tile->vals[i]);
+                    heatPixels[i * 4] = c.r;
+                    heatPixels[i * 4 + 1] = c.g;
+                    heatPixels[i * 4 + 2] = c.b;
+                    heatPixels[i * 4 + 3] = 255;
+                }
+            }
+            if (ht.tex.getSize().x != static_cast<unsigned>(T)) ht.tex.create(T, T);
+            ht.tex.update(heatPixels.data());
+            ht.src = tile;
+        }
+        return &ht.tex;
+    }
+    
+    void drawHeatmap() {
+        std::shared_ptr<Equation> eq = domain && domainEq ? domainEq : heatmap ? heatSource() : nullptr;
+        View v = {xMin, xMax, yMin, yMax, w, h};
+        heat.request(eq, v);
+        if (!eq) {
+            heatTex.clear();
+            return;
+        }
+        
+        const int T = HeatmapCache::tile;
+        int zx, zy;
+        long tx0, tx1, ty0, ty1;
+        HeatmapCache::levels(v, zx, zy);
+        HeatmapCache::range(v, zx, zy, tx0, tx1, ty0, ty1);
+        double wx = ldexp(1.0, zx), wy = ldexp(1.0, zy);
+        for (auto& t : heatTex) t.second.used = false;
+        
+        for (long tx = tx0; tx <= tx1; tx++) {
+            for (long ty = ty0; ty <= ty1; ty++) {
+                // While a tile is computed, stretch the matching part of a coarser cached one.
+                for (int d = 0; d <= 3; d++) {
+                    long span = 1L << d;
+                    long px = static_cast<long>(floor(tx / static_cast<double>(span)));
+                    long py = static_cast<long>(floor(ty / static_cast<double>(span)));
+                    const sf::Texture* tex = heatTexture(HeatKey{zx + d, zy + d, px, py});
+                    if (!tex) continue;
+                    
+                    float sub = static_cast<float>(T) / span;
+                    float u = (tx - px * span) * sub;
+                    float t = (span - 1 - (ty - py * span)) * sub;
+                    sf::Vector2f tl = toScreen(tx * wx, (ty + 1) * wy);
+                    sf::Vector2f br = toScreen((tx + 1) * wx, ty * wy);
+                    heatQuad[0] = sf::Vertex(tl, sf::Vector2f(u, t));
+                    heatQuad[1] = sf::Vertex(sf::Vector2f(br.x, tl.y), sf::Vector2f(u + sub, t));
+                    heatQuad[2] = sf::Vertex(sf::Vector2f(tl.x, br.y), sf::Vector2f(u, t + sub));
+                    heatQuad[3] = sf::Vertex(br, sf::Vector2f(u + sub, t + sub));
+                    
+                    sf::RenderStates states;
+                    states.texture = tex;
+                    stats.vertices += 4;
+                    win.draw(heatQuad, states);
+                    break;
+                }
+            }
+        }
+        
+        for (auto it = heatTex.begin(); it != heatTex.end();) {
+            it = it->second.used ? std::next(it) : heatTex.erase(it);
+        }
+    }
+    
+    sf::Color dataColor(size_t i) const { return cols[cols.size() - 1 - i % cols.size()]; }
+    
+    void drawData() {
+        dataLines.clear();
+        for (size_t i = 0; i < data.size(); i++) {
+            data[i]->decimate(xMin, xMax, w, dataPts);
+            sf::Color col = dataColor(i);
+            for (size_t k = 0; k + 1 < dataPts.size(); k++) {
+                if (!std::isfinite(dataPts[k].y) || !std::isfinite(dataPts[k + 1].y)) continue;
+                sf::Vector2f a = toScreen(dataPts[k].x, dataPts[k].y);
+                sf::Vector2f b = toScreen(dataPts[k + 1].x, dataPts[k + 1].y);
+                a.y = std::max(-4.0f * h, std::min(5.0f * h, a.y));
+                b.y = std::max(-4.0f * h, std::min(5.0f * h, b.y));
+                dataLines.append(sf::Vertex(a, col));
+                dataLines.append(sf::Vertex(b, col));
+            }
+        }
+        
+        stats.vertices += dataLines.getVertexCount();
+        win.draw(dataLines);
+    }
+    
+    const std::vector<sf::Vertex>& labelLayout(double v) {
+        auto it = labelLayouts.find(v);
+        if (it != labelLayouts.end()) return *it->second;
+        const std::vector<sf::Vertex>& quads = labelText.layout(fmtNum(v));
+        labelLayouts.emplace(v, &quads);
+        return quads;
+    }
+    
+    void drawLabels() {
+        if (!hasFont) return;
+        
+        double rx = xMax - xMin;
+        double ry = yMax - yMin;
+        
+        double lx = pow(10, floor(log10(rx / 6)));
+        double ly = pow(10, floor(log10(ry / 6)));
+        
+        if (rx / lx < 4) lx /= 2;
+        if (ry / ly < 4) ly /= 2;
+        
+        if (lx != labelStepX || ly != labelStepY || labelLayouts.size() > 512) {
+            labelStepX = lx;
+            labelStepY = ly;
+            labelLayouts.clear();
+            labelText.forget();
+        }
+        labelText.clear();
+        
+        double startX = ceil(xMin / lx) * lx;
+        int cnt = 0;
+        for (double x = startX; x <= xMax && cnt < 8; x += lx, cnt++) {
+            if (fabs(x) > lx / 10) {
+                sf::Vector2f pos = toScreen(x, 0);
+                if (pos.y > h - 20) pos.y = h - 20;
+                if (pos.y < 15) pos.y = 15;
+                
+                labelText.add(labelLayout(x), sf::Vector2f(pos.x - 15, pos.y + 5), sf::Color::White);
+            }
+        }
+        
+        double startY = ceil(yMin / ly) * ly;
+        cnt = 0;
+        for (double y = startY; y <= yMax && cnt < 8; y += ly, cnt++) {
+            if (fabs(y) > ly / 10) {
+                sf::Vector2f pos = toScreen(0, y);
+                if (pos.x > w - 50) pos.x = w - 50;
+                if (pos.x < 5) pos.x = 5;
+                
+                labelText.add(labelLayout(y), sf::Vector2f(pos.x + 5, pos.y - 6), sf::Color::White);
+            }
+        }
+        
+        stats.vertices += labelText.vertexCount();
+        labelText.draw(win);
+    }
+    
+    void uploadCurves(const std::shared_ptr<const Snapshot>& snap) {
+        ProfileScope prof("uploadCurves");
+        uploaded = snap;
+        uploadedEqs = eqs;
+        curveVerts.clear();
+        
+        const View& v = snap->view;
+        auto screen = [&v](const CurvePoint& p) {
+            float sx = static_cast<float>((p.x - v.xMin) / (v.xMax - v.xMin) * v.w);
+            float sy = static_cast<float>(v.h - (p.y - v.yMin) / (v.yMax - v.yMin) * v.h);
+            return sf::Vector2f(sx, std::max(-4.0f * v.h, std::min(5.0f * v.h, sy)));
+        };
+        
+        for (size_t k = 0; k < snap->eqs.size(); k++) {
+            auto it = std::find(eqs.begin(), eqs.end(), snap->eqs[k]);
+            if (it == eqs.end()) continue;
+            size_t idx = it - eqs.begin();
+            sf::Color col = cols[idx % cols.size()];
+            ProfileScope eqProf("uploadEq", &eqs[idx]->text, profiling ? &stats.eqDrawNs[idx] : nullptr);
+            
+            for (const auto& line : snap->lines[k]) {
+                for (size_t i = 0; i + 1 < line.size(); i++) {
+                    curveVerts.push_back(sf::Vertex(screen(line[i]), col));
+                    curveVerts.push_back(sf::Vertex(screen(line[i + 1]), col));
+                }
+            }
+        }
+        
+        if (!sf::VertexBuffer::isAvailable()) return;
+        if (curveBuf.getVertexCount() < curveVerts.size()) {
+            curveBuf.create(curveVerts.size() + curveVerts.size() / 2);
+        }
+        curveBuf.update(curveVerts.data(), curveVerts.size(), 0);
+    }
+    
+    void drawEqs() {
+        sampler.request({xMin, xMax, yMin, yMax, w, h}, eqs);
+        std::shared_ptr<const Snapshot> snap = sampler.latest();
+        if (!snap) return;
+        if (snap != uploaded || eqs != uploadedEqs) uploadCurves(snap);
+        if (curveVerts.empty()) return;
+        
+        // Vertices sit in the snapshot's screen space; map them onto the current view.
+        const View& v = snap->view;
+        sf::Vector2f origin = toScreen(v.xMin, v.yMax);
+        sf::RenderStates states;
+        states.transform.translate(origin.x, origin.y);
+        states.transform.scale(static_cast<float>((v.xMax - v.xMin) / (xMax - xMin) * w / v.w),
+                               static_cast<float>((v.yMax - v.yMin) / (yMax - yMin) * h / v.h));
+        
+        stats.vertices += curveVerts.size();
+        if (sf::VertexBuffer::isAvailable()) {
+            win.draw(curveBuf, 0, curveVerts.size(), states);
+        } else {
+            win.draw(curveVerts.data(), curveVerts.size(), sf::Lines, states);
+        }
+    }
+    
+    bool settled() {
+        std::shared_ptr<const Snapshot> snap = sampler.latest();
+        return snap && !snap->coarse && snap->eqs == eqs && snap->view == View{xMin, xMax, yMin, yMax, w, h};
+    }
+    
+    size_t evalCount() const {
+        size_t n = 0;
+        for (const auto& eq : eqs) n += eq->evals;
+        return n;
+    }
+    
+    // True when the next draw() would differ from the last one.
+    bool needsRedraw() {
+        return dirty || profiling || sampler.latest() != uploaded || ((heatmap || domain) && heat.version() != drawnHeat) ||
+               (marking && analyzer.version() != drawnMarks);
+    }
+    
+    // True while background work is still going to change the picture.
+    bool busy() {
+        return profiling || !settled() || ((heatmap || domain) && heat.pending()) || (marking && analyzer.pending());
+    }
+    
+    void drawList() {
+        if (!hasFont) return;
+        
+        if (listed != eqs || listedData != data.size() || listedDomain != domainEq) {
+            listed = eqs;
+            listedData = data.size();
+            listedDomain = domainEq;
+            listText.forget();
+            listText.clear();
+            for (size_t i = 0; i < eqs.size(); i++) {
+                listText.add(listText.layout(eqs[i]->text), sf::Vector2f(10, 10 + i * 20.0f), cols[i % cols.size()]);
+            }
+            for (size_t i = 0; i < data.size(); i++) {
+                listText.add(listText.layout(data[i]->label()), sf::Vector2f(10, 10 + (eqs.size() + i) * 20.0f), dataColor(i));
+            }
+            if (domainEq) {
+                listText.add(listText.layout("f(z) = " + domainEq->text), sf::Vector2f(10, 10 + (eqs.size() + data.size()) * 20.0f),
+                             sf::Color::White);
+            }
+        }
+        
+        stats.vertices += listText.vertexCount();
+        listText.draw(win);
+    }
+    
+    void drawSliders() {
+        if (symbols.params.empty()) return;
+        if (sliderText.cached() > 256) sliderText.forget();
+        sliderText.clear();
+        sliderShapes.clear();
+        
+        auto rect = [this](float x, float y, float rw, float rh, sf::Color c) {
+            sf::Vector2f a(x, y), b(x + rw, y), d(x, y + rh), e(x + rw, y + rh);
+            for (sf::Vector2f v : {a, b, d, b, e, d}) sliderShapes.append(sf::Vertex(v, c));
+        };
+        
+        float y = sliderTop();
+        std::ostringstream oss;
+        for (const auto& prm : symbols.params) {
+            const Symbols::Param& p = prm.second;
+            float t = p.hi > p.lo ? static_cast<float>((p.value - p.lo) / (p.hi - p.lo)) : 0.5f;
+            bool active = prm.first == activeSlider;
+            rect(10, y + 18, 200, 4, sf::Color(90, 90, 90));
+            rect(5 + 200 * t, y + 14, 10, 12, active ? sf::Color::Green : sf::Color(200, 200, 200));
+            
+            oss.str("");
+            oss << prm.first << " = " << std::setprecision(4) << p.value;
+            sliderText.add(sliderText.layout(oss.str()), sf::Vector2f(10, y - 2), sf::Color::White);
+            y += 30;
+        }
+        
+        stats.vertices += sliderShapes.getVertexCount() + sliderText.vertexCount();
+        win.draw(sliderShapes);
+        sliderText.draw(win);
+    }
+    
+    // Roots are squares, extrema diamonds, both in the curve's colour; intersections
+    // are white squares. Only the first few get a coordinate label.
+    void drawMarks() {
+        if (!marking) return;
+        std::shared_ptr<const Snapshot> snap = sampler.latest();
+        if (settled()) analyzer.request(snap);
+        std::shared_ptr<const Analysis> found = analyzer.latest();
+        if (!found) return;
+        
+        if (markText.cached() > 256) markText.forget();
+        markText.clear();
+        markShapes.clear();
+        
+        const int maxLabels = 64;
+        int labels = 0;
+        std::ostringstream oss;
+        oss << std::setprecision(4);
+        for (const Feature& f : found->features) {
+            if (f.x < xMin || f.x > xMax || f.y < yMin || f.y > yMax) continue;
+            auto it = std::find(eqs.begin(), eqs.end(), f.a);
+            if (it == eqs.end() || (f.b && std::find(eqs.begin(), eqs.end(), f.b) == eqs.end())) continue;
+            
+            sf::Color col = f.kind == Feature::Intersection ? sf::Color::White : cols[(it - eqs.begin()) % cols.size()];
+            sf::Vector2f c = toScreen(f.x, f.y);
+            float r = 4;
+            sf::Vector2f a, b, d, e;
+            if (f.kind == Feature::Extremum) {
+                a = c + sf::Vector2f(0, -r - 1);
+                b = c + sf::Vector2f(r + 1, 0);
+                d = c + sf::Vector2f(-r - 1, 0);
+                e = c + sf::Vector2f(0, r + 1);
+            } else {
+                a = c + sf::Vector2f(-r, -r);
+                b = c + sf::Vector2f(r, -r);
+                d = c + sf::Vector2f(-r, r);
+                e = c + sf::Vector2f(r, r);
+            }
+            for (sf::Vector2f v : {a, b, d, b, e, d}) markShapes.append(sf::Vertex(v, col));
+            
+            if (!hasFont || labels >= maxLabels) continue;
+            oss.str("");
+            oss << "(" << f.x << ", " << f.y << ")";
+            markText.add(markText.layout(oss.str()), c + sf::Vector2f(6, -16), sf::Color(220, 220, 220));
+            labels++;
+        }
+        
+        stats.vertices += markShapes.getVertexCount() + markText.vertexCount();
+        win.draw(markShapes);
+        markText.draw(win);
+    }
+    
+    bool isMarking() const { return marking; }
+    void setMarking(bool on) {
+        marking = on;
+        dirty = true;
+    }
+    
+    bool isDomain() const { return domain; }
+    void setDomain(bool on) {
+        domain = on;
+        dirty = true;
+    }
+    
+    bool isHeatmap() const { return heatmap; }
+    void setHeatmap(bool on) {
+        heatmap = on;
+        dirty = true;
+    }
+    void setHeatmapBudget(size_t bytes) { heat.setBudget(bytes); }
+    
+    bool isProfiling() const { return profiling; }
+    
+    void setProfiling(bool on) {
+        profiling = on;
+        dirty = true;
+        Profiler::get().enable(on);
+        stats = FrameStats();
+        report.clear();
+        frameClock.restart();
+        reportClock.restart();
+    }
+    
+    bool writeTrace(const std::string& path) { return Profiler::get().writeTrace(path); }
+    
+    void collectStats() {
+        size_t n = eqs.size();
+        if (stats.evalsSeen.size() != n) {
+            stats.eqDrawNs.resize(n);
+            stats.eqSampleNs.resize(n);
+            stats.evalsSeen.resize(n);
+            stats.sampleSeen.resize(n);
+            for (size_t i = 0; i < n; i++) {
+                stats.evalsSeen[i] = eqs[i]->evals;
+                stats.sampleSeen[i] = eqs[i]->sampleNs;
+            }
+        }
+        for (size_t i = 0; i < n; i++) {
+            size_t e = eqs[i]->evals, s = eqs[i]->sampleNs;
+            stats.evals += e - stats.evalsSeen[i];
+            stats.eqSampleNs[i] += s - stats.sampleSeen[i];
+            stats.evalsSeen[i] = e;
+            stats.sampleSeen[i] = s;
+        }
+        stats.frameMs += frameClock.restart().asSeconds() * 1000;
+        stats.frames++;
+        if (reportClock.getElapsedTime().asSeconds() < 0.25f) return;
+        
+        static const char* stageNames[8] = {"heatmap", "grid", "axes", "labels", "data", "eqs", "marks", "list"};
+        double f = stats.frames;
+        auto ms = [f](size_t ns) { return ns / 1e6 / f; };
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(2);
+        report.clear();
+        oss << "frame " << stats.frameMs / f << " ms";
+        report.push_back(oss.str());
+        for (int k = 0; k < 8; k++) {
+            oss.str("");
+            oss << stageNames[k] << " " << ms(stats.stageNs[k]) << " ms";
+            report.push_back(oss.str());
+        }
+        oss.str("");
+        oss << std::setprecision(0) << "evals/frame " << stats.evals / f << "  vertices " << stats.vertices / f;
+        report.push_back(oss.str());
+        oss << std::setprecision(2);
+        for (size_t i = 0; i < n; i++) {
+            oss.str("");
+            oss << eqs[i]->text << ": draw " << ms(stats.eqDrawNs[i]) << " ms  sample " << ms(stats.eqSampleNs[i]) << " ms";
+            report.push_back(oss.str());
+        }
+        
+        std::vector<size_t> evalsSeen = stats.evalsSeen, sampleSeen = stats.sampleSeen;
+        stats = FrameStats();
+        stats.eqDrawNs.resize(n);
+        stats.eqSampleNs.resize(n);
+        stats.evalsSeen = evalsSeen;
+        stats.sampleSeen = sampleSeen;
+        reportClock.restart();
+    }
+    
+    void drawProfile() {
+        if (!hasFont || report.empty()) return;
+        
+        float lineH = 15;
+        sf::RectangleShape bg(sf::Vector2f(300, lineH * report.size() + 10));
+        bg.setPosition(w - 310.0f, 10);
+        bg.setFillColor(sf::Color(0, 0, 0, 190));
+        win.draw(bg);
+        
+        for (size_t i = 0; i < report.size(); i++) {
+            sf::Text txt(report[i], font, 12);
+            txt.setPosition(w - 305.0f, 15 + i * lineH);
+            txt.setFillColor(sf::Color(200, 255, 200));
+            win.draw(txt);
+        }
+    }
+    
+    void draw() {
+        ProfileScope frame("frame");
+        dirty = false;
+        drawnHeat = heat.version();
+        drawnMarks = analyzer.version();
+        if (profiling && stats.eqDrawNs.size() != eqs.size()) {
+            stats.eqDrawNs.resize(eqs.size());
+        }
+        {
+            ProfileScope prof("drawHeatmap", nullptr, &stats.stageNs[0]);
+            drawHeatmap();
+        }
+        {
+            ProfileScope prof("drawGrid", nullptr, &stats.stageNs[1]);
+            drawGrid();
+        }
+        {
+            ProfileScope prof("drawAxes", nullptr, &stats.stageNs[2]);
+            drawAxes();
+        }
+        {
+            ProfileScope prof("drawLabels", nullptr, &stats.stageNs[3]);
+            drawLabels();
+        }
+        {
+            ProfileScope prof("drawData", nullptr, &stats.stageNs[4]);
+            drawData();
+        }
+        {
+            ProfileScope prof("drawEqs", nullptr, &stats.stageNs[5]);
+            drawEqs();
+        }
+        {
+            ProfileScope prof("drawMarks", nullptr, &stats.stageNs[6]);
+            drawMarks();
+        }
+        {
+            ProfileScope prof("drawList", nullptr, &stats.stageNs[7]);
+            drawList();
+            drawSliders();
+        }
+        if (profiling) {
+            collectStats();
+            drawProfile();
+        } else {
+            stats.vertices = 0;
+        }
+    }
+};
+
+#endif